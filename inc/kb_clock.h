@@ -0,0 +1,63 @@
+#ifndef KB_CLOCK__H
+#define KB_CLOCK__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/vreg.h"
+
+//--------------------------------------------------------------------+
+// System clock governor
+//--------------------------------------------------------------------+
+
+// Lowers clk_sys and the core voltage while no key is held and while the bus is suspended,
+// and goes back to full speed as soon as core1 sees a key.
+// clk_sys stays at or above 48 MHz at every level: the bus can resume or reset at any time,
+// suspend included, and tud_task() has to keep up with the controller.
+// pll_sys keeps running, and clk_usb and clk_peri run from pll_usb (48 MHz),
+// so USB, the stdio UART and the split link keep their timing at every level.
+#ifndef KB_CLOCK_SCALING
+#define KB_CLOCK_SCALING 0
+#endif
+
+// Time without any key held before the clock is lowered
+#define KB_CLOCK_IDLE_MS 3000
+// Time given to the regulator after raising the voltage, before the clock goes up
+#define KB_CLOCK_VREG_SETTLE_US 20
+
+enum
+{
+  KB_CLOCK_FULL = 0,        /**< Keys held or recently pressed. */
+  KB_CLOCK_IDLE,            /**< No key for KB_CLOCK_IDLE_MS, clk_sys = pll_sys / 2. */
+  KB_CLOCK_SUSPEND,         /**< Bus suspended and no key, clk_sys = pll_usb (48 MHz). */
+  KB_CLOCK_NUM_OF_LEVELS
+};
+
+typedef struct
+{
+  bool from_pll_usb;        /**< clk_sys source: pll_usb instead of pll_sys. */
+  uint8_t sys_div;          /**< clk_sys = source / sys_div. */
+  enum vreg_voltage vreg;
+  uint16_t estimate_ua;     /**< Rough board current at this level, for the estimate only. */
+} kb_clock_level_t;
+
+typedef struct
+{
+  uint8_t level;
+  uint32_t transitions;
+  uint32_t transition_max_us;   /**< Longest level switch, voltage settle included. */
+  uint32_t wake_us;             /**< Last time from the first key seen by core1 to full clock. */
+  uint32_t wake_max_us;
+  uint64_t level_us[KB_CLOCK_NUM_OF_LEVELS];
+  uint32_t estimate_ua;         /**< Mean current estimated from the time spent at each level. */
+} kb_clock_stats_t;
+
+// Core0, before anything sets up a UART: moves clk_peri to pll_usb
+void kb_clock_init(void);
+// Core1: a key is held, called every scan with the scan loop's millisecond clock
+void kb_clock_activity(uint32_t now_ms);
+// Core0: picks the level from the key activity and the bus state
+void kb_clock_task(void);
+kb_clock_stats_t kb_clock_get_stats(void);
+void kb_clock_print(void);
+
+#endif //KB_CLOCK__H
@@ -0,0 +1,42 @@
+#ifndef KB_HEATMAP__H
+#define KB_HEATMAP__H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "kb_matrix.h"
+
+//--------------------------------------------------------------------+
+// Per-key press counters
+//--------------------------------------------------------------------+
+
+// Counters are saved to the last flash sector, only when something changed and
+// no key is held for KB_HEATMAP_SAVE_IDLE_MS. The first save of a session only waits for that,
+// so short sessions keep their counts; later ones come at most every KB_HEATMAP_SAVE_INTERVAL_MS.
+// Saving stalls both cores for a sector erase (~50 ms), hence the interval, which also bounds
+// the wear: 8 h of typing a day is 32 erases, the sector lasts 100k.
+#define KB_HEATMAP_SAVE_INTERVAL_MS (15 * 60 * 1000)
+#define KB_HEATMAP_SAVE_IDLE_MS 2000
+
+#define KB_HEATMAP_VERSION 1
+#define KB_NUM_OF_MATRIX_KEYS (KB_NUM_OF_ROWS * KB_NUM_OF_COLS)
+
+// Exported over the HID feature channel, little endian.
+// Key N is the matrix position row = N / KB_NUM_OF_COLS, col = N % KB_NUM_OF_COLS.
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t version;                               /**< KB_HEATMAP_VERSION. */
+  uint8_t num_of_rows;
+  uint8_t num_of_cols;
+  uint8_t reserved;
+  uint32_t press_count[KB_NUM_OF_MATRIX_KEYS];   /**< Number of presses. */
+  uint32_t hold_ms[KB_NUM_OF_MATRIX_KEYS];       /**< Total time held, in ms. */
+} kb_heatmap_blob_t;
+
+// scratch: count this session from zero and never save it, the saved counters are kept as they are
+void kb_heatmap_init(bool scratch);
+void kb_heatmap_update(kb_matrix_t const* matrix, uint32_t now_ms);
+void kb_heatmap_task(uint32_t now_ms);
+uint16_t kb_heatmap_read(uint32_t offset, uint8_t* buffer, uint16_t len);
+
+#endif //KB_HEATMAP__H
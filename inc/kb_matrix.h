@@ -6,6 +6,7 @@
 #include "tusb.h"
 
 #include "usb_descriptors.h"
+#include "kb_mouse.h"
 
 #define KB_NUM_OF_KEYS 68
 #define KB_NUM_OF_COLS 15
@@ -31,6 +32,26 @@
     KB_COL_PIN_12, KB_COL_PIN_13, KB_COL_PIN_14 \
   }\
 
+// Hot path in SRAM: the scan/debounce/report functions and their lookup tables are copied
+// to SRAM at boot, so core0's tud_task() cannot evict them from the shared XIP cache
+// and the scan period does not depend on cache misses
+#ifndef KB_HOT_PATH_IN_RAM
+#define KB_HOT_PATH_IN_RAM 0
+#endif
+
+#if KB_HOT_PATH_IN_RAM
+#define KB_HOT_FUNC(func) __not_in_flash_func(func)
+#define KB_HOT_DATA(group) __not_in_flash(group)
+#else
+#define KB_HOT_FUNC(func) func
+#define KB_HOT_DATA(group)
+#endif
+
+// Time a driven column is given before the rows are read
+#define KB_COL_SETTLE_US 10
+// Key state changes within this time after a change are contact bounce
+#define KB_DEBOUNCE_US 5000
+
 #define KB_NUM_OF_ROWS 5
 #define KB_ROW_PIN_0 2
 #define KB_ROW_PIN_1 3
@@ -64,6 +85,12 @@
                      HID_KEY_NONE, HID_KEY_ALT_RIGHT, HID_KEY_GUI_RIGHT, HID_KEY_CONTROL_RIGHT, HID_KEY_ARROW_LEFT, HID_KEY_ARROW_DOWN, HID_KEY_ARROW_RIGHT} /*4,15*/ \
                   }
 
+// Holding this key (Esc) while plugging in silences the statistics log and counts the heatmap from zero
+// for that session only, the counters saved to flash are left untouched.
+// It does not shorten the boot, see boot_key_held in main.c
+#define KB_BOOT_KEY_ROW 0
+#define KB_BOOT_KEY_COL 0
+
 #define KB_NUM_OF_KEY_ALTERNATE_KEY_CODE 15
 #define KB_ALTERNATE_KEY_CODE {\
                   {HID_KEY_1, HID_KEY_F1}, {HID_KEY_2, HID_KEY_F2}, {HID_KEY_3, HID_KEY_F3}, {HID_KEY_4, HID_KEY_F4}, \
@@ -79,7 +106,24 @@
                   {HID_KEY_ARROW_UP, USB_HID_VOL_UP}, {HID_KEY_ARROW_DOWN, USB_HID_VOL_DEC} \
                  }
 
-#define KB_MAX_NUM_OF_KEYCODES (6+8)
+// Fn + these keys drive the mouse instead of typing
+#define KB_NUM_OF_MOUSE_KEY_CODE 9
+#define KB_MOUSE_KEY_CODE {\
+                  {HID_KEY_I, KB_MOUSE_UP}, {HID_KEY_K, KB_MOUSE_DOWN}, {HID_KEY_J, KB_MOUSE_LEFT}, {HID_KEY_L, KB_MOUSE_RIGHT}, \
+                  {HID_KEY_Y, KB_MOUSE_WHEEL_UP}, {HID_KEY_H, KB_MOUSE_WHEEL_DOWN}, \
+                  {HID_KEY_U, KB_MOUSE_BUTTON_LEFT}, {HID_KEY_O, KB_MOUSE_BUTTON_RIGHT}, {HID_KEY_P, KB_MOUSE_BUTTON_MIDDLE} \
+                 }
+
+// NKRO: every key of the matrix can be reported at once
+#define KB_MAX_NUM_OF_KEYCODES KB_NUM_OF_KEYS
+
+// Matrix snapshot: one word per row, bit N is set when the key in column N is pressed
+typedef uint16_t kb_row_mask_t;
+
+typedef struct
+{
+  kb_row_mask_t rows[KB_NUM_OF_ROWS];
+} kb_matrix_t;
 
 typedef struct TU_ATTR_PACKED
 {
@@ -91,12 +135,41 @@ typedef struct TU_ATTR_PACKED
 {
   uint8_t modifier;                /**< Keyboard modifier (KEYBOARD_MODIFIER_* masks). */
   uint8_t keycode[6];              /**< Key codes of the currently pressed keys. */
+  uint8_t nkro_keys[USB_HID_NKRO_NUM_OF_KEYS / 8]; /**< All pressed keys as a bitmap (NKRO report). */
   uint8_t media_key;
+  uint16_t mouse_keys;             /**< KB_MOUSE_* bits of the held mouse keys. */
   uint8_t fn_pressed;
 } kb_report_t;
 
+// Ready-to-send reports for every HID interface, built on core1 and sent as-is by core0
+typedef struct TU_ATTR_PACKED
+{
+  hid_keyboard_report_t boot;      /**< Boot keyboard interface report. */
+  hid_nkro_report_t nkro;          /**< NKRO interface report. */
+  uint8_t consumer;                /**< Consumer control report (USB_HID_* media bits). */
+  uint16_t mouse_keys;             /**< Held mouse keys (KB_MOUSE_*), the motion is stepped by core0. */
+  uint8_t num_of_keycodes;         /**< Number of pressed keys, including modifiers and Fn. */
+} kb_hid_payload_t;
+
+// Byte compare inlined into the hot path, memcmp() lives in flash
+__force_inline static bool kb_hid_payload_equal(kb_hid_payload_t const* a, kb_hid_payload_t const* b){
+  uint8_t const* a_bytes = (uint8_t const*) a;
+  uint8_t const* b_bytes = (uint8_t const*) b;
+  for(uint i = 0; i < sizeof(kb_hid_payload_t); i++){
+    if(a_bytes[i] != b_bytes[i]) return false;
+  }
+  return true;
+}
+
 void init_kb_matrix(void);
+void scan_kb_matrix(kb_matrix_t* matrix);
+void debounce_kb_matrix(kb_matrix_t* matrix, uint32_t now_us);
+bool read_kb_key(uint8_t row_idx, uint8_t col_idx);
+kb_pressed_keycodes_t kb_matrix_to_keycodes(kb_matrix_t const* matrix);
+void get_kb_matrix(kb_matrix_t* matrix);
 kb_pressed_keycodes_t get_kb_keycodes(void); 
 kb_report_t parse_kb_report(kb_pressed_keycodes_t kb_status);
+kb_hid_payload_t build_kb_hid_payload(kb_pressed_keycodes_t kb_status);
+bool kb_hid_payload_only_releases(kb_hid_payload_t const* from, kb_hid_payload_t const* to, bool boot_protocol);
 
 #endif //KB_MATRIX__H
\ No newline at end of file
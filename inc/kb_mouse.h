@@ -0,0 +1,59 @@
+#ifndef KB_MOUSE__H
+#define KB_MOUSE__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tusb.h"
+
+//--------------------------------------------------------------------+
+// Mouse keys
+//--------------------------------------------------------------------+
+
+// Mouse key bits, as resolved from the Fn layer. The high byte holds the buttons (MOUSE_BUTTON_* masks)
+#define KB_MOUSE_UP            0x0001
+#define KB_MOUSE_DOWN          0x0002
+#define KB_MOUSE_LEFT          0x0004
+#define KB_MOUSE_RIGHT         0x0008
+#define KB_MOUSE_WHEEL_UP      0x0010
+#define KB_MOUSE_WHEEL_DOWN    0x0020
+#define KB_MOUSE_BUTTONS_SHIFT 8
+#define KB_MOUSE_BUTTON_LEFT   (MOUSE_BUTTON_LEFT << KB_MOUSE_BUTTONS_SHIFT)
+#define KB_MOUSE_BUTTON_RIGHT  (MOUSE_BUTTON_RIGHT << KB_MOUSE_BUTTONS_SHIFT)
+#define KB_MOUSE_BUTTON_MIDDLE (MOUSE_BUTTON_MIDDLE << KB_MOUSE_BUTTONS_SHIFT)
+#define KB_MOUSE_BUTTONS       (0xFF << KB_MOUSE_BUTTONS_SHIFT)
+
+// Speeds are in Q8.8 fixed point per ms, so one report per 1 ms frame moves by a fraction
+// of a pixel at low speed and the remainder is carried to the next report.
+// Pointer speed ramps from MIN to MAX along a smoothstep curve over KB_MOUSE_ACCEL_MS of holding.
+#define KB_MOUSE_SPEED_MIN_Q8   51    // 0.2 px/ms = 200 px/s
+#define KB_MOUSE_SPEED_MAX_Q8   384   // 1.5 px/ms = 1500 px/s
+#define KB_MOUSE_ACCEL_MS       600
+#define KB_MOUSE_WHEEL_SPEED_Q8 5     // ~20 detents/s
+// A longer gap between two steps (endpoint busy, host not polling) is not caught up on
+#define KB_MOUSE_MAX_STEP_US    8000
+
+typedef struct
+{
+  bool moving;
+  uint32_t start_us;   /**< Start of the current movement, for the acceleration. */
+  uint32_t last_us;    /**< Time of the previous step. */
+  int32_t x_q8;        /**< Sub-pixel remainders, Q8.8. */
+  int32_t y_q8;
+  int32_t wheel_q8;
+  uint32_t move_rem;   /**< Remainders of the per-ms speed scaling, so short steps lose nothing. */
+  uint32_t wheel_rem;
+  uint16_t keys;       /**< Mouse keys of the previous step, to tell when an axis starts moving. */
+} kb_mouse_t;
+
+typedef struct
+{
+  int8_t x;
+  int8_t y;
+  int8_t wheel;
+} kb_mouse_motion_t;
+
+void kb_mouse_reset(kb_mouse_t* mouse);
+// Motion for the time since the previous step, returns false if it is zero on all axes
+bool kb_mouse_step(kb_mouse_t* mouse, uint16_t mouse_keys, uint32_t now_us, kb_mouse_motion_t* motion);
+
+#endif //KB_MOUSE__H
@@ -0,0 +1,34 @@
+#ifndef KB_PAYLOAD_QUEUE__H
+#define KB_PAYLOAD_QUEUE__H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "kb_matrix.h"
+
+//--------------------------------------------------------------------+
+// Payload queue from core1 to core0
+//--------------------------------------------------------------------+
+
+// Lock-free FIFO with a single producer (core1) and a single consumer (core0).
+// Replaces the SDK queue on the scan loop: queue_try_add() takes a spin lock and lives in flash.
+// Must be a power of two, the indexes are free running counters
+#define KB_PAYLOAD_QUEUE_LEN 32
+
+TU_VERIFY_STATIC((KB_PAYLOAD_QUEUE_LEN & (KB_PAYLOAD_QUEUE_LEN - 1)) == 0, "KB_PAYLOAD_QUEUE_LEN must be a power of two");
+
+typedef struct
+{
+  kb_hid_payload_t entries[KB_PAYLOAD_QUEUE_LEN];
+  volatile uint32_t wr;    /**< Payloads ever pushed, written by the producer only. */
+  volatile uint32_t rd;    /**< Payloads ever popped, written by the consumer only. */
+} kb_payload_queue_t;
+
+void kb_payload_queue_init(kb_payload_queue_t* queue);
+// Producer: returns false if the queue is full
+bool kb_payload_queue_push(kb_payload_queue_t* queue, kb_hid_payload_t const* payload);
+// Consumer: returns false if the queue is empty
+bool kb_payload_queue_peek(kb_payload_queue_t* queue, kb_hid_payload_t* payload);
+bool kb_payload_queue_pop(kb_payload_queue_t* queue, kb_hid_payload_t* payload);
+
+#endif //KB_PAYLOAD_QUEUE__H
@@ -0,0 +1,85 @@
+#ifndef KB_PERF__H
+#define KB_PERF__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/structs/systick.h"
+
+//--------------------------------------------------------------------+
+// Loop period statistics
+//--------------------------------------------------------------------+
+
+// Print the statistics over stdio every KB_PERF_LOG_INTERVAL_MS
+#ifndef KB_PERF_LOG
+#define KB_PERF_LOG 0
+#endif
+
+#define KB_PERF_LOG_INTERVAL_MS 5000
+
+typedef struct
+{
+  bool started;        /**< False until the first tick, which only sets last_us. */
+  uint32_t last_us;
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t sum_us;
+  uint64_t sum_sq_us;  /**< For the variance of the period. */
+} kb_period_stats_t;
+
+void kb_period_reset(kb_period_stats_t* stats);
+void kb_period_tick(kb_period_stats_t* stats, uint32_t now_us);
+// Adds a measured duration directly, e.g. a latency
+void kb_period_add(kb_period_stats_t* stats, uint32_t period_us);
+void kb_period_print(char const* name, kb_period_stats_t const* stats);
+
+//--------------------------------------------------------------------+
+// Cycle counting
+//--------------------------------------------------------------------+
+
+// SysTick of the calling core as a free running 24-bit down counter at clk_sys
+void kb_cycles_init(void);
+
+static inline uint32_t kb_cycles_now(void){
+  return systick_hw->cvr;
+}
+
+static inline uint32_t kb_cycles_elapsed(uint32_t start, uint32_t end){
+  // SysTick counts down
+  return (start - end) & 0x00FFFFFF;
+}
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+} kb_cycle_stats_t;
+
+void kb_cycle_stats_add(kb_cycle_stats_t* stats, uint32_t cycles);
+// Also prints the mean cost as a share of the mean period, e.g. of the loop the code runs in
+void kb_cycle_stats_print(char const* name, kb_cycle_stats_t const* stats, kb_period_stats_t const* period);
+
+//--------------------------------------------------------------------+
+// Boot phase timestamps
+//--------------------------------------------------------------------+
+
+// Phases in the order they are normally reached. Time is counted from the timer start in the
+// runtime init, the bootrom and boot2 (copying the flash loader, setting up XIP) come before it
+enum
+{
+  KB_BOOT_MATRIX_INIT = 0,   /**< init_kb_matrix() done. */
+  KB_BOOT_CORE1_LAUNCHED,    /**< Core1 started scanning. */
+  KB_BOOT_BOARD_INIT,        /**< board_init() done. */
+  KB_BOOT_USB_INIT,          /**< tud_init() done. */
+  KB_BOOT_FIRST_SCAN,        /**< Core1 finished its first matrix scan. */
+  KB_BOOT_MOUNTED,           /**< Host configured the device. */
+  KB_BOOT_FIRST_REPORT,      /**< First report handed to an endpoint. */
+  KB_BOOT_NUM_OF_PHASES
+};
+
+void kb_boot_mark(uint8_t phase);
+uint32_t kb_boot_time_us(uint8_t phase);
+void kb_boot_print(void);
+
+#endif //KB_PERF__H
@@ -0,0 +1,92 @@
+#ifndef KB_SPLIT__H
+#define KB_SPLIT__H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "kb_matrix.h"
+
+//--------------------------------------------------------------------+
+// Split keyboard link
+//--------------------------------------------------------------------+
+
+// Both halves run the same firmware. The primary half is plugged into USB,
+// the secondary half scans its own columns and sends them over the UART link.
+#ifndef KB_SPLIT_ENABLED
+#define KB_SPLIT_ENABLED 0
+#endif
+
+#ifndef KB_SPLIT_SECONDARY
+#define KB_SPLIT_SECONDARY 0
+#endif
+
+// GP0/GP1 are the only UART pins left free by the matrix, so stdio UART is off in split builds
+#define KB_SPLIT_UART uart0
+#define KB_SPLIT_UART_IRQ UART0_IRQ
+#define KB_SPLIT_UART_TX_PIN 0
+#define KB_SPLIT_UART_RX_PIN 1
+
+// 2 Mbaud: 5 us per byte, the longest frame (full sync) is 15 bytes = 75 us on the wire
+#define KB_SPLIT_BAUD_RATE 2000000
+
+// Secondary sends its full matrix this often even when nothing changed
+#define KB_SPLIT_SYNC_INTERVAL_MS 100
+// Primary drops the remote matrix if the link has been silent for this long
+#define KB_SPLIT_LINK_TIMEOUT_MS 500
+// Primary measures the link latency with a ping this often
+#define KB_SPLIT_PING_INTERVAL_MS 1000
+// One-way latency the link is designed for, pings above it are counted in over_budget
+#define KB_SPLIT_LATENCY_BUDGET_US 200
+
+/* Frame layout:
+ *   [SOF] [SEQ] [TYPE << 4 | LEN] [PAYLOAD x LEN] [CRC8]
+ * CRC-8 (poly 0x07) covers SEQ, TYPE/LEN and PAYLOAD.
+ *
+ * MATRIX payload: [row present mask] then 2 bytes (LSB first) for every row present.
+ * Row values are absolute, so a frame is a delta when it carries only the changed rows
+ * and a full sync when it carries all of them.
+ * There are no ACKs: the primary replies NAK only on CRC or sequence errors,
+ * and the secondary answers a NAK with a full sync.
+ */
+#define KB_SPLIT_SOF 0xA5
+#define KB_SPLIT_MAX_PAYLOAD_LEN (1 + 2 * KB_NUM_OF_ROWS)
+#define KB_SPLIT_MAX_FRAME_LEN (4 + KB_SPLIT_MAX_PAYLOAD_LEN)
+
+enum
+{
+  KB_SPLIT_FRAME_MATRIX = 1,
+  KB_SPLIT_FRAME_NAK,
+  KB_SPLIT_FRAME_PING,
+  KB_SPLIT_FRAME_PONG,
+};
+
+typedef struct
+{
+  uint32_t frames_tx;
+  uint32_t frames_rx;
+  uint32_t crc_errors;
+  uint32_t seq_errors;
+  uint32_t full_syncs;
+  uint32_t link_timeouts;
+  uint32_t latency_us;     /**< Last measured one-way latency (half of the ping round trip). */
+  uint32_t max_latency_us;
+  uint32_t over_budget;    /**< Pings with a one-way latency above KB_SPLIT_LATENCY_BUDGET_US. */
+} kb_split_stats_t;
+
+void kb_split_init(void);
+void kb_split_send_matrix(kb_matrix_t const* matrix);
+void kb_split_merge_remote(kb_matrix_t* matrix);
+// Primary: exported over the HID feature channel, little endian
+kb_split_stats_t kb_split_get_stats(void);
+// Called by the transport for every byte received, from its interrupt
+void kb_split_rx_byte(uint8_t byte);
+
+//--------------------------------------------------------------------+
+// Split link transport
+//--------------------------------------------------------------------+
+
+// Moves the frame bytes, nothing else: kb_split_uart.c on the board, a socketpair in the host test
+void kb_split_port_init(void);
+void kb_split_port_write(uint8_t const* data, uint len);
+
+#endif //KB_SPLIT__H
@@ -0,0 +1,71 @@
+#ifndef KB_TRACE__H
+#define KB_TRACE__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+//--------------------------------------------------------------------+
+// Pipeline trace
+//--------------------------------------------------------------------+
+
+// Records the pipeline stages of both cores from the first key edge after mount until a buffer is full
+// or KB_TRACE_CAPTURE_MS have passed, then prints them over stdio as Chrome trace JSON
+// (load it in ui.perfetto.dev or chrome://tracing).
+// Each queued payload is a flow from its enqueue on core1 to the reports and polls on core0.
+// Only work is recorded: scan passes that changed no payload and tud_task() calls without
+// an event are left out, so a capture holds seconds of typing.
+#ifndef KB_TRACE
+#define KB_TRACE 0
+#endif
+
+// Events recorded per core, 12 bytes each
+#define KB_TRACE_LEN 1024
+// Longest capture, counted from the first key edge
+#define KB_TRACE_CAPTURE_MS 10000
+
+enum
+{
+  KB_TRACE_SCAN = 0,     /**< Core1: matrix scan, including the split merge. Kept by kb_trace_pass_end(). */
+  KB_TRACE_DEBOUNCE,     /**< Core1: debounce decision. Kept by kb_trace_pass_end(). */
+  KB_TRACE_LAYER,        /**< Core1: Fn layer resolution and report building. Kept by kb_trace_pass_end(). */
+  KB_TRACE_ENQUEUE,      /**< Core1: payload queued to core0, starts a flow and the capture. */
+  KB_TRACE_USB_TASK,     /**< Core0: tud_task() that had an event to process. */
+  KB_TRACE_REPORT,       /**< Core0: report handed to an endpoint. */
+  KB_TRACE_POLL,         /**< Core0: host polled the report, ends a flow. */
+  KB_TRACE_NUM_OF_STAGES
+};
+
+#if KB_TRACE
+static inline uint32_t kb_trace_now(void){
+  return time_us_32();
+}
+
+// flow_id: payload the stage works on, 0 if none
+void kb_trace_slice(uint8_t stage, uint32_t start_us, uint32_t end_us, uint32_t flow_id);
+// Core1, end of a scan pass: its scan, debounce and layer slices are recorded if the payload changed
+void kb_trace_pass_end(bool payload_changed);
+// Core0: arms the capture once mounted and prints the trace once recorded
+void kb_trace_task(void);
+#else
+// Compiled out, no timer reads on the hot path
+static inline uint32_t kb_trace_now(void){
+  return 0;
+}
+
+static inline void kb_trace_slice(uint8_t stage, uint32_t start_us, uint32_t end_us, uint32_t flow_id){
+  (void) stage;
+  (void) start_us;
+  (void) end_us;
+  (void) flow_id;
+}
+
+static inline void kb_trace_pass_end(bool payload_changed){
+  (void) payload_changed;
+}
+
+static inline void kb_trace_task(void){
+}
+#endif
+
+#endif //KB_TRACE__H
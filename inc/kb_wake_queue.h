@@ -0,0 +1,44 @@
+#ifndef KB_WAKE_QUEUE__H
+#define KB_WAKE_QUEUE__H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "kb_matrix.h"
+
+//--------------------------------------------------------------------+
+// Wake queue
+//--------------------------------------------------------------------+
+
+// Payload changes seen while the bus is suspended are queued and replayed in order after
+// resume, so the keystroke that woke the host reaches it. Core0 only.
+#define KB_WAKE_QUEUE_LEN 8
+// Replay window, counted from the resume: a host takes from tens of ms to seconds to resume,
+// so events are not aged while it sleeps. What is still queued once the window is over
+// (endpoint never ready) is dropped, the live payload then brings the host up to date.
+#define KB_WAKE_REPLAY_TIMEOUT_MS 2000
+
+typedef struct
+{
+  kb_hid_payload_t payloads[KB_WAKE_QUEUE_LEN];
+  uint head;
+  uint count;
+  uint32_t resume_ms;
+  bool resumed;             /**< resume_ms is set, by the resume or by the first replay. */
+} kb_wake_queue_t;
+
+// Bus suspended: forgets the events of the previous suspend
+void kb_wake_queue_clear(kb_wake_queue_t* queue);
+// Once full, the first events stay in order and the last entry tracks the latest state,
+// so nothing stays pressed after the replay
+void kb_wake_queue_push(kb_wake_queue_t* queue, kb_hid_payload_t const* payload);
+// Bus resumed: starts the replay window
+void kb_wake_queue_resume(kb_wake_queue_t* queue, uint32_t now_ms);
+// Oldest event to replay. Returns false once the queue is empty or the replay window is over,
+// the window starts here if no resume was seen (bus reset instead of resume)
+bool kb_wake_queue_peek(kb_wake_queue_t* queue, uint32_t now_ms, kb_hid_payload_t* payload);
+// The event returned by kb_wake_queue_peek() reached the host
+void kb_wake_queue_pop(kb_wake_queue_t* queue);
+uint kb_wake_queue_count(kb_wake_queue_t const* queue);
+
+#endif //KB_WAKE_QUEUE__H
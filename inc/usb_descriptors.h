@@ -58,13 +58,74 @@
 		 HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_WRAP_NO | HID_LINEAR | HID_PREFERRED_STATE | HID_NO_NULL_POSITION ),                  \
 		 HID_COLLECTION_END,              /* End Collection                                                                                   */\
 
+// NKRO Keyboard Report Descriptor Template
+// Modifier byte followed by one bit per usage 0..USB_HID_NKRO_NUM_OF_KEYS-1, LED output as in the boot keyboard
+#define USB_HID_NKRO_NUM_OF_KEYS 128
+
+#define MY_TUD_HID_REPORT_DESC_NKRO(...) \
+		 HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP ),         /* Usage Page (Generic Desktop)                                                   */\
+		 HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD ),     /* Usage (Keyboard)                                                               */\
+		 HID_COLLECTION ( HID_COLLECTION_APPLICATION ),     /* Collection (Application)                                                       */\
+         /* Report ID if any */                                                                                \
+         __VA_ARGS__                                                                                           \
+		 HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD ),        /*   Usage Page (Keyboard): modifiers                                             */\
+		 HID_USAGE_MIN  ( 224 ),                            /*   Usage Minimum (Left Control)                                                 */\
+		 HID_USAGE_MAX  ( 231 ),                            /*   Usage Maximum (Right GUI)                                                    */\
+		 HID_LOGICAL_MIN( 0 ),                              /*   Logical Minimum (0)                                                          */\
+		 HID_LOGICAL_MAX( 1 ),                              /*   Logical Maximum (1)                                                          */\
+		 HID_REPORT_COUNT( 8 ),                             /*   Report Count (8)                                                             */\
+		 HID_REPORT_SIZE ( 1 ),                             /*   Report Size (1)                                                              */\
+		 HID_INPUT      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),                                            \
+		 HID_USAGE_MIN  ( 0 ),                              /*   Usage Minimum (0): key bitmap                                                */\
+		 HID_USAGE_MAX  ( USB_HID_NKRO_NUM_OF_KEYS - 1 ),   /*   Usage Maximum                                                                */\
+		 HID_REPORT_COUNT( USB_HID_NKRO_NUM_OF_KEYS ),      /*   Report Count (one bit per key)                                               */\
+		 HID_REPORT_SIZE ( 1 ),                             /*   Report Size (1)                                                              */\
+		 HID_INPUT      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),                                            \
+		 HID_USAGE_PAGE ( HID_USAGE_PAGE_LED ),             /*   Usage Page (LEDs)                                                            */\
+		 HID_USAGE_MIN  ( 1 ),                              /*   Usage Minimum (Num Lock)                                                     */\
+		 HID_USAGE_MAX  ( 5 ),                              /*   Usage Maximum (Kana)                                                         */\
+		 HID_REPORT_COUNT( 5 ),                             /*   Report Count (5)                                                             */\
+		 HID_REPORT_SIZE ( 1 ),                             /*   Report Size (1)                                                              */\
+		 HID_OUTPUT     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),                                            \
+		 HID_REPORT_COUNT( 1 ),                             /*   Report Count (1): LED padding                                                */\
+		 HID_REPORT_SIZE ( 3 ),                             /*   Report Size (3)                                                              */\
+		 HID_OUTPUT     ( HID_CONSTANT ),                                                                      \
+		 HID_COLLECTION_END,              /* End Collection                                                                                   */\
+
+// Vendor Feature Report Descriptor Template
+// A single feature report of USB_HID_FEATURE_REPORT_SIZE bytes, read by host tools (e.g. hidapi)
+#define USB_HID_FEATURE_REPORT_SIZE 32
+
+#define MY_TUD_HID_REPORT_DESC_FEATURE(...) \
+		 HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2 ),     /* Usage Page (Vendor Defined 0xFF00)                                             */\
+		 HID_USAGE      ( 0x01 ),                           /* Usage (0x01)                                                                   */\
+		 HID_COLLECTION ( HID_COLLECTION_APPLICATION ),     /* Collection (Application)                                                       */\
+         /* Report ID if any */                                                                                \
+         __VA_ARGS__                                                                                           \
+		 HID_USAGE      ( 0x02 ),                           /*   Usage (0x02)                                                                 */\
+		 HID_LOGICAL_MIN( 0x00 ),                           /*   Logical Minimum (0)                                                          */\
+		 HID_LOGICAL_MAX_N( 0xFF, 2 ),                      /*   Logical Maximum (255)                                                        */\
+		 HID_REPORT_SIZE( 8 ),                              /*   Report Size (8)                                                              */\
+		 HID_REPORT_COUNT( USB_HID_FEATURE_REPORT_SIZE ),   /*   Report Count                                                                 */\
+		 HID_FEATURE    ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),                                            \
+		 HID_COLLECTION_END,              /* End Collection                                                                                   */\
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t modifier;                                 /**< Keyboard modifier (KEYBOARD_MODIFIER_* masks). */
+  uint8_t keys[USB_HID_NKRO_NUM_OF_KEYS / 8];       /**< Bit N is set when usage N is pressed. */
+} hid_nkro_report_t;
+
+// Every report class has its own HID interface and IN endpoint, so no report IDs are used.
+// TinyUSB numbers HID instances in interface order, so these are also the instance numbers.
 enum
 {
-  REPORT_ID_KEYBOARD = 1,
-//  REPORT_ID_MOUSE,
-  REPORT_ID_CONSUMER_CONTROL,
-//  REPORT_ID_GAMEPAD,
-  REPORT_ID_COUNT
+  ITF_NUM_KEYBOARD = 0,   // Boot keyboard, 6KRO, used by BIOS/UEFI (boot protocol)
+  ITF_NUM_NKRO,           // NKRO keyboard, used by the OS (report protocol)
+  ITF_NUM_CONSUMER,       // Consumer control (media keys)
+  ITF_NUM_FEATURE,        // Vendor feature channel (key press heatmap and split link statistics export)
+  ITF_NUM_MOUSE,          // Mouse keys
+  ITF_NUM_TOTAL
 };
 
 #endif /* USB_DESCRIPTORS_H_ */
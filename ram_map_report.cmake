@@ -0,0 +1,30 @@
+# Lists what the linker placed in SRAM through __not_in_flash / __not_in_flash_func,
+# read from the linker map. Run after the build:
+#   cmake -DMAP_FILE=<elf>.map -DREPORT_FILE=<report> -P ram_map_report.cmake
+
+if(NOT EXISTS "${MAP_FILE}")
+  message(FATAL_ERROR "Linker map ${MAP_FILE} not found")
+endif()
+
+file(READ "${MAP_FILE}" map)
+set(map "\n${map}")
+
+# Input sections are listed as " .time_critical.<name>", followed by address, size and object,
+# on the same line or, for long names, on the next one
+string(REGEX MATCHALL "\n \\.time_critical\\.[A-Za-z0-9_.]+[ \t\r\n]+0x[0-9a-f]+[ \t]+0x[0-9a-f]+[ \t]+[^\r\n]+" entries "${map}")
+
+set(report "Moved to SRAM (.time_critical.*):\n")
+set(total 0)
+foreach(entry IN LISTS entries)
+  string(REGEX MATCH "\\.time_critical\\.([A-Za-z0-9_.]+)[ \t\r\n]+(0x[0-9a-f]+)[ \t]+(0x[0-9a-f]+)[ \t]+([^\r\n]+)" _ "${entry}")
+  set(name "${CMAKE_MATCH_1}")
+  set(address "${CMAKE_MATCH_2}")
+  math(EXPR size "${CMAKE_MATCH_3}")
+  get_filename_component(object "${CMAKE_MATCH_4}" NAME)
+  math(EXPR total "${total} + ${size}")
+  string(APPEND report "  ${address} ${size}\t${name} (${object})\n")
+endforeach()
+string(APPEND report "Total: ${total} bytes\n")
+
+file(WRITE "${REPORT_FILE}" "${report}")
+message(STATUS "${report}")
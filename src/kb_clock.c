@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+#include "kb_matrix.h"
+#include "kb_clock.h"
+
+#if KB_CLOCK_SCALING
+
+// Current figures are rough numbers for a Pico board with both cores running, measure for real ones.
+// Suspend runs from pll_usb: 48 MHz is the lowest clk_sys that keeps up with the controller
+static kb_clock_level_t const clock_levels[KB_CLOCK_NUM_OF_LEVELS] =
+{
+  [KB_CLOCK_FULL]    = { .from_pll_usb = false, .sys_div = 1, .vreg = VREG_VOLTAGE_1_10, .estimate_ua = 25000 },
+  [KB_CLOCK_IDLE]    = { .from_pll_usb = false, .sys_div = 2, .vreg = VREG_VOLTAGE_1_05, .estimate_ua = 16000 },
+  [KB_CLOCK_SUSPEND] = { .from_pll_usb = true,  .sys_div = 1, .vreg = VREG_VOLTAGE_1_00, .estimate_ua = 12000 },
+};
+
+static char const* const clock_level_names[KB_CLOCK_NUM_OF_LEVELS] =
+{
+  "full",
+  "idle",
+  "suspend",
+};
+
+static uint32_t pll_sys_hz;
+static kb_clock_stats_t clock_stats;
+static uint64_t level_since_us;
+
+// Written by core1, level only by core0
+static volatile uint8_t clock_level = KB_CLOCK_FULL;
+static volatile uint32_t last_activity_ms;
+static volatile uint32_t wake_request_us;
+static volatile bool wake_requested = false;
+
+void kb_clock_init(void){
+  // UART baud rates are derived from clk_peri, which follows clk_sys by default
+  clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, 48 * MHZ, 48 * MHZ);
+
+  pll_sys_hz = clock_get_hz(clk_sys);
+  level_since_us = time_us_64();
+}
+
+void KB_HOT_FUNC(kb_clock_activity)(uint32_t now_ms){
+  last_activity_ms = now_ms;
+
+  // Only the first key after a lowered clock is timed
+  if((clock_level != KB_CLOCK_FULL) && !wake_requested){
+    wake_request_us = time_us_32();
+    __dmb();
+    wake_requested = true;
+  }
+}
+
+static uint32_t level_src_hz(kb_clock_level_t const* level){
+  return level->from_pll_usb ? 48 * MHZ : pll_sys_hz;
+}
+
+static void account_level_time(void){
+  uint64_t const now_us = time_us_64();
+  clock_stats.level_us[clock_level] += now_us - level_since_us;
+  level_since_us = now_us;
+}
+
+static void clock_set_level(uint8_t level){
+  kb_clock_level_t const* from = &clock_levels[clock_level];
+  kb_clock_level_t const* to = &clock_levels[level];
+  uint32_t const start_us = time_us_32();
+
+  account_level_time();
+
+  // The voltage goes up before the clock does and down after it
+  if(to->vreg > from->vreg){
+    vreg_set_voltage(to->vreg);
+    busy_wait_us_32(KB_CLOCK_VREG_SETTLE_US);
+  }
+  uint32_t const auxsrc = to->from_pll_usb ? CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB :
+                                              CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS;
+  clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX, auxsrc,
+                  level_src_hz(to), level_src_hz(to) / to->sys_div);
+  if(to->vreg < from->vreg){
+    vreg_set_voltage(to->vreg);
+  }
+
+  clock_level = level;
+
+  uint32_t const transition_us = time_us_32() - start_us;
+  if(transition_us > clock_stats.transition_max_us) clock_stats.transition_max_us = transition_us;
+  clock_stats.transitions ++;
+}
+
+void kb_clock_task(void){
+  uint32_t const now_ms = to_ms_since_boot(get_absolute_time());
+
+  // A key wins over suspend: it is about to wake the host
+  uint8_t level;
+  if(wake_requested || (now_ms - last_activity_ms < KB_CLOCK_IDLE_MS)){
+    level = KB_CLOCK_FULL;
+  }else if(tud_suspended()){
+    level = KB_CLOCK_SUSPEND;
+  }else{
+    level = KB_CLOCK_IDLE;
+  }
+
+  if(level != clock_level) clock_set_level(level);
+
+  if(wake_requested && (clock_level == KB_CLOCK_FULL)){
+    clock_stats.wake_us = time_us_32() - wake_request_us;
+    if(clock_stats.wake_us > clock_stats.wake_max_us) clock_stats.wake_max_us = clock_stats.wake_us;
+    wake_requested = false;
+  }
+}
+
+kb_clock_stats_t kb_clock_get_stats(void){
+  account_level_time();
+  clock_stats.level = clock_level;
+
+  uint64_t total_us = 0;
+  uint64_t charge = 0;
+  for(uint level = 0; level < KB_CLOCK_NUM_OF_LEVELS; level++){
+    total_us += clock_stats.level_us[level];
+    charge += clock_stats.level_us[level] * clock_levels[level].estimate_ua;
+  }
+  clock_stats.estimate_ua = total_us ? (uint32_t) (charge / total_us) : 0;
+
+  return clock_stats;
+}
+
+void kb_clock_print(void){
+  kb_clock_stats_t const stats = kb_clock_get_stats();
+
+  printf("clock: %s, ~%lu uA mean, %lu transitions (max %lu us), key to full clock last=%lu us max=%lu us\n",
+         clock_level_names[stats.level], (unsigned long) stats.estimate_ua, (unsigned long) stats.transitions,
+         (unsigned long) stats.transition_max_us, (unsigned long) stats.wake_us, (unsigned long) stats.wake_max_us);
+  for(uint level = 0; level < KB_CLOCK_NUM_OF_LEVELS; level++){
+    printf("  %-8s %lu MHz %8lu ms\n", clock_level_names[level],
+           (unsigned long) (level_src_hz(&clock_levels[level]) / clock_levels[level].sys_div / MHZ),
+           (unsigned long) (stats.level_us[level] / 1000));
+  }
+}
+
+#endif // KB_CLOCK_SCALING
@@ -0,0 +1,126 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "kb_heatmap.h"
+
+#define KB_HEATMAP_MAGIC 0x314D484B  // "KHM1"
+#define KB_HEATMAP_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+typedef struct TU_ATTR_PACKED
+{
+  uint32_t magic;
+  kb_heatmap_blob_t blob;
+} kb_heatmap_record_t;
+
+#define KB_HEATMAP_RECORD_FLASH_SIZE \
+  ((sizeof(kb_heatmap_record_t) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE)
+
+TU_VERIFY_STATIC(KB_HEATMAP_RECORD_FLASH_SIZE <= FLASH_SECTOR_SIZE, "Heatmap record must fit one flash sector");
+
+static bool heatmap_enabled = false;
+static bool heatmap_saving = false;
+static kb_heatmap_blob_t heatmap;
+static kb_matrix_t heatmap_prev_matrix;
+static uint32_t heatmap_press_ms[KB_NUM_OF_MATRIX_KEYS];
+
+static bool heatmap_dirty = false;
+static uint32_t heatmap_last_edge_ms = 0;
+static uint32_t heatmap_last_save_ms = 0;
+static bool heatmap_save_tried = false;
+
+static uint8_t heatmap_flash_buf[KB_HEATMAP_RECORD_FLASH_SIZE] __attribute__((aligned(4)));
+
+void kb_heatmap_init(bool scratch){
+  kb_heatmap_record_t const* saved = (kb_heatmap_record_t const*) (XIP_BASE + KB_HEATMAP_FLASH_OFFSET);
+
+  if(!scratch && (saved->magic == KB_HEATMAP_MAGIC) && (saved->blob.version == KB_HEATMAP_VERSION) &&
+     (saved->blob.num_of_rows == KB_NUM_OF_ROWS) && (saved->blob.num_of_cols == KB_NUM_OF_COLS)){
+    memcpy(&heatmap, &saved->blob, sizeof(heatmap));
+  }else{
+    // Scratch session, blank or written by another layout: start counting from zero
+    memset(&heatmap, 0, sizeof(heatmap));
+    heatmap.version = KB_HEATMAP_VERSION;
+    heatmap.num_of_rows = KB_NUM_OF_ROWS;
+    heatmap.num_of_cols = KB_NUM_OF_COLS;
+  }
+
+  heatmap_saving = !scratch;
+  heatmap_enabled = true;
+}
+
+// Called once per scan. Only the set bits of the edge masks are visited,
+// so the cost is a few instructions per row when nothing changed
+void KB_HOT_FUNC(kb_heatmap_update)(kb_matrix_t const* matrix, uint32_t now_ms){
+  if(!heatmap_enabled) return;
+
+  kb_row_mask_t changed = 0;
+  for(int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    kb_row_mask_t const cur = matrix->rows[row_idx];
+    kb_row_mask_t const prev = heatmap_prev_matrix.rows[row_idx];
+    uint32_t pressed = cur & ~prev;
+    uint32_t released = prev & ~cur;
+    changed |= cur ^ prev;
+
+    while(pressed){
+      uint const key_idx = row_idx * KB_NUM_OF_COLS + __builtin_ctz(pressed);
+      pressed &= pressed - 1;
+      heatmap.press_count[key_idx] ++;
+      heatmap_press_ms[key_idx] = now_ms;
+    }
+    while(released){
+      uint const key_idx = row_idx * KB_NUM_OF_COLS + __builtin_ctz(released);
+      released &= released - 1;
+      heatmap.hold_ms[key_idx] += now_ms - heatmap_press_ms[key_idx];
+    }
+  }
+
+  if(changed){
+    heatmap_dirty = true;
+    heatmap_last_edge_ms = now_ms;
+    heatmap_prev_matrix = *matrix;
+  }
+}
+
+static void heatmap_flash_write(void* param){
+  (void) param;
+  flash_range_erase(KB_HEATMAP_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+  flash_range_program(KB_HEATMAP_FLASH_OFFSET, heatmap_flash_buf, sizeof(heatmap_flash_buf));
+}
+
+// Saves the counters in one batch, called from the scan loop.
+// Only the checks run every scan, the save itself is allowed to run from flash
+void KB_HOT_FUNC(kb_heatmap_task)(uint32_t now_ms){
+  if(!heatmap_saving || !heatmap_dirty) return;
+  if(heatmap_save_tried && (now_ms - heatmap_last_save_ms < KB_HEATMAP_SAVE_INTERVAL_MS)) return;
+  if(now_ms - heatmap_last_edge_ms < KB_HEATMAP_SAVE_IDLE_MS) return;
+
+  // Hold time of held keys is only added on release
+  for(int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    if(heatmap_prev_matrix.rows[row_idx] != 0) return;
+  }
+
+  // Built in place, a record on the stack would take a third of core1's stack
+  kb_heatmap_record_t* record = (kb_heatmap_record_t*) heatmap_flash_buf;
+  memset(heatmap_flash_buf, 0xFF, sizeof(heatmap_flash_buf));
+  record->magic = KB_HEATMAP_MAGIC;
+  memcpy(&record->blob, &heatmap, sizeof(heatmap));
+
+  // Retried on the next interval if the other core could not be locked out
+  heatmap_last_save_ms = now_ms;
+  heatmap_save_tried = true;
+  if(flash_safe_execute(heatmap_flash_write, NULL, 100) == PICO_OK){
+    heatmap_dirty = false;
+  }
+}
+
+// Copies part of the blob, zeros past its end. Counters are updated on the other core,
+// a read may mix values of two consecutive scans, which is fine for statistics
+uint16_t kb_heatmap_read(uint32_t offset, uint8_t* buffer, uint16_t len){
+  memset(buffer, 0, len);
+  if(offset >= sizeof(heatmap)) return len;
+
+  uint32_t const copy_len = tu_min32(len, sizeof(heatmap) - offset);
+  memcpy(buffer, ((uint8_t const*) &heatmap) + offset, copy_len);
+  return len;
+}
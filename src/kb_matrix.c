@@ -1,13 +1,20 @@
 #include <stdlib.h>
+#include <string.h>
 #include "pico/stdlib.h"
+#include "hardware/structs/timer.h"
 #include "kb_matrix.h"
 #include "usb_descriptors.h"
+#include "kb_split.h"
+#include "kb_trace.h"
 
-const uint kb_columns[KB_NUM_OF_COLS] = KB_COL_PINS;
-const uint kb_rows[KB_NUM_OF_ROWS] = KB_ROW_PINS;
-const uint kb_key_codes[KB_NUM_OF_ROWS][KB_NUM_OF_COLS] = KB_KEY_CODES;
-const uint kb_alternate_key_codes[KB_NUM_OF_KEY_ALTERNATE_KEY_CODE][2] = KB_ALTERNATE_KEY_CODE;
-const uint kb_media_key_codes[KB_NUM_OF_MEDIA_KEY_CODE][2] = KB_MEDIA_KEY_CODE;
+const uint KB_HOT_DATA("kb_columns") kb_columns[KB_NUM_OF_COLS] = KB_COL_PINS;
+const uint KB_HOT_DATA("kb_rows") kb_rows[KB_NUM_OF_ROWS] = KB_ROW_PINS;
+const uint KB_HOT_DATA("kb_key_codes") kb_key_codes[KB_NUM_OF_ROWS][KB_NUM_OF_COLS] = KB_KEY_CODES;
+const uint KB_HOT_DATA("kb_alternate_key_codes") kb_alternate_key_codes[KB_NUM_OF_KEY_ALTERNATE_KEY_CODE][2] = KB_ALTERNATE_KEY_CODE;
+const uint KB_HOT_DATA("kb_media_key_codes") kb_media_key_codes[KB_NUM_OF_MEDIA_KEY_CODE][2] = KB_MEDIA_KEY_CODE;
+const uint KB_HOT_DATA("kb_mouse_key_codes") kb_mouse_key_codes[KB_NUM_OF_MOUSE_KEY_CODE][2] = KB_MOUSE_KEY_CODE;
+
+TU_VERIFY_STATIC(KB_NUM_OF_COLS <= 8 * sizeof(kb_row_mask_t), "kb_row_mask_t is too narrow for KB_NUM_OF_COLS");
 
 
 //--------------------------------------------------------------------+
@@ -28,16 +35,81 @@ void init_kb_matrix(void){
   }
 }
 
-kb_pressed_keycodes_t get_kb_keycodes(void){
+// busy_wait_us_32() lives in flash, this wait stays in the caller
+__force_inline static void wait_column_settle(void){
+  uint32_t const start_us = timer_hw->timerawl;
+  while(timer_hw->timerawl - start_us < KB_COL_SETTLE_US){
+    tight_loop_contents();
+  }
+}
+
+void KB_HOT_FUNC(scan_kb_matrix)(kb_matrix_t* matrix){
+  // Clear structure
+  memset(matrix, 0, sizeof(*matrix));
+
+  for (int col_idx = 0; col_idx < KB_NUM_OF_COLS; col_idx++) {
+    gpio_put(kb_columns[col_idx], 1);
+    // Also lets the rows of the previous column fall back through the pull-downs
+    wait_column_settle();
+    uint32_t const gpios = gpio_get_all();
+    for (int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++) {
+      if(gpios & (1u << kb_rows[row_idx])){
+        matrix->rows[row_idx] |= (kb_row_mask_t)(1u << col_idx);
+      }
+    }
+    gpio_put(kb_columns[col_idx], 0);
+  }
+}
+
+// Eager per-key debounce: a change is taken at once and the key is then locked for
+// KB_DEBOUNCE_US, so contact bounce is ignored but a tap of any length gives a press and,
+// at the latest KB_DEBOUNCE_US later, a release. Only keys that changed or are locked are visited.
+static kb_matrix_t debounced_matrix;
+static kb_matrix_t debounce_locked;
+static uint32_t debounce_ts_us[KB_NUM_OF_ROWS][KB_NUM_OF_COLS];
+
+void KB_HOT_FUNC(debounce_kb_matrix)(kb_matrix_t* matrix, uint32_t now_us){
+  for (int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++) {
+    uint32_t locked = debounce_locked.rows[row_idx];
+    uint32_t expired = 0;
+    while(locked){
+      int const col_idx = __builtin_ctz(locked);
+      locked &= locked - 1;
+      if(now_us - debounce_ts_us[row_idx][col_idx] >= KB_DEBOUNCE_US) expired |= 1u << col_idx;
+    }
+    debounce_locked.rows[row_idx] &= (kb_row_mask_t) ~expired;
+
+    uint32_t changed = (matrix->rows[row_idx] ^ debounced_matrix.rows[row_idx]) & ~debounce_locked.rows[row_idx];
+    debounced_matrix.rows[row_idx] ^= (kb_row_mask_t) changed;
+    debounce_locked.rows[row_idx] |= (kb_row_mask_t) changed;
+    while(changed){
+      int const col_idx = __builtin_ctz(changed);
+      changed &= changed - 1;
+      debounce_ts_us[row_idx][col_idx] = now_us;
+    }
+
+    matrix->rows[row_idx] = debounced_matrix.rows[row_idx];
+  }
+}
+
+// Reads a single key without a full scan, used for the boot key check
+bool read_kb_key(uint8_t row_idx, uint8_t col_idx){
+  gpio_put(kb_columns[col_idx], 1);
+  busy_wait_us_32(KB_COL_SETTLE_US);
+  bool const pressed = gpio_get(kb_rows[row_idx]);
+  gpio_put(kb_columns[col_idx], 0);
+  return pressed;
+}
+
+kb_pressed_keycodes_t KB_HOT_FUNC(kb_matrix_to_keycodes)(kb_matrix_t const* matrix){
   kb_pressed_keycodes_t res;
   // Clear structure
   memset(&res, 0, sizeof(res));
 
+  // Column-major walk keeps the keycode order the same as the order keys are scanned
   for (int col_idx = 0; col_idx < KB_NUM_OF_COLS; col_idx++) {
-    gpio_put(kb_columns[col_idx], 1);
-    sleep_ms(1);
     for (int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++) {
-      if(gpio_get(kb_rows[row_idx])){
+      if(matrix->rows[row_idx] & (1u << col_idx)){
         if(res.num_of_keycodes < KB_MAX_NUM_OF_KEYCODES){
           uint8_t keycode = kb_key_codes[row_idx][col_idx];
           if(keycode != HID_KEY_NONE){
@@ -47,16 +119,37 @@ kb_pressed_keycodes_t get_kb_keycodes(void){
         }
       }
     }
-    gpio_put(kb_columns[col_idx], 0);
-    sleep_ms(1);
   }
 
   return res;
 }
 
-kb_report_t parse_kb_report(kb_pressed_keycodes_t kb_status){
+void KB_HOT_FUNC(get_kb_matrix)(kb_matrix_t* matrix){
+  uint32_t const scan_start_us = kb_trace_now();
+  scan_kb_matrix(matrix);
+
+#if KB_SPLIT_ENABLED
+  // Keys of the other half are reported over the split link in the same bitmap format
+  kb_split_merge_remote(matrix);
+#endif
+
+  uint32_t const debounce_start_us = kb_trace_now();
+  debounce_kb_matrix(matrix, time_us_32());
+  kb_trace_slice(KB_TRACE_SCAN, scan_start_us, debounce_start_us, 0);
+  kb_trace_slice(KB_TRACE_DEBOUNCE, debounce_start_us, kb_trace_now(), 0);
+}
+
+kb_pressed_keycodes_t KB_HOT_FUNC(get_kb_keycodes)(void){
+  kb_matrix_t matrix;
+  get_kb_matrix(&matrix);
+  return kb_matrix_to_keycodes(&matrix);
+}
+
+kb_report_t KB_HOT_FUNC(parse_kb_report)(kb_pressed_keycodes_t kb_status){
   kb_report_t report;
   memset(&report, 0, sizeof(report));
+  // All non-modifier keys, the boot report only gets the first 6 of them
+  uint8_t keycodes[KB_MAX_NUM_OF_KEYCODES];
   uint cur_keycode_idx = 0;
   uint num_of_parsed_keycodes = 0;
 
@@ -96,7 +189,7 @@ kb_report_t parse_kb_report(kb_pressed_keycodes_t kb_status){
         break;
       }
       default:{
-        report.keycode[cur_keycode_idx] = kb_status.keycode[status_keycode_idx];
+        keycodes[cur_keycode_idx] = kb_status.keycode[status_keycode_idx];
         cur_keycode_idx ++;
         break;
       }
@@ -105,12 +198,33 @@ kb_report_t parse_kb_report(kb_pressed_keycodes_t kb_status){
 
   num_of_parsed_keycodes = cur_keycode_idx;
 
+  // Parse mouse keycodes, they are taken out of the keyboard report
+  if(report.fn_pressed != 0){
+    uint num_of_kept_keycodes = 0;
+    for(uint keycode_idx=0; keycode_idx<num_of_parsed_keycodes; keycode_idx++){
+      uint16_t mouse_key = 0;
+      for(uint i=0; i<KB_NUM_OF_MOUSE_KEY_CODE; i++){
+        if(keycodes[keycode_idx] == kb_mouse_key_codes[i][0]){
+          mouse_key = (uint16_t) kb_mouse_key_codes[i][1];
+          break;
+        }
+      }
+      if(mouse_key != 0){
+        report.mouse_keys |= mouse_key;
+      }else{
+        keycodes[num_of_kept_keycodes] = keycodes[keycode_idx];
+        num_of_kept_keycodes ++;
+      }
+    }
+    num_of_parsed_keycodes = num_of_kept_keycodes;
+  }
+
   // Parse alternate keycodes
   if(report.fn_pressed != 0){
     for(uint keycode_idx=0; keycode_idx<num_of_parsed_keycodes; keycode_idx++){
       for(uint i=0; i<KB_NUM_OF_KEY_ALTERNATE_KEY_CODE; i++){
-        if(report.keycode[keycode_idx] == kb_alternate_key_codes[i][0]){
-          report.keycode[keycode_idx] = kb_alternate_key_codes[i][1];
+        if(keycodes[keycode_idx] == kb_alternate_key_codes[i][0]){
+          keycodes[keycode_idx] = kb_alternate_key_codes[i][1];
           break;
         }
       }
@@ -121,7 +235,7 @@ kb_report_t parse_kb_report(kb_pressed_keycodes_t kb_status){
   if(report.fn_pressed != 0){
     for(uint keycode_idx=0; keycode_idx<num_of_parsed_keycodes; keycode_idx++){
       for(uint i=0; i<KB_NUM_OF_MEDIA_KEY_CODE; i++){
-        if(report.keycode[keycode_idx] == kb_media_key_codes[i][0]){
+        if(keycodes[keycode_idx] == kb_media_key_codes[i][0]){
           report.media_key |= kb_media_key_codes[i][1];
           break;
         }
@@ -129,5 +243,65 @@ kb_report_t parse_kb_report(kb_pressed_keycodes_t kb_status){
     }
   }
 
+  // Fill boot (6KRO) and NKRO key fields
+  for(uint keycode_idx=0; keycode_idx<num_of_parsed_keycodes; keycode_idx++){
+    uint8_t const keycode = keycodes[keycode_idx];
+    if(keycode_idx < sizeof(report.keycode)){
+      report.keycode[keycode_idx] = keycode;
+    }
+    if(keycode < USB_HID_NKRO_NUM_OF_KEYS){
+      report.nkro_keys[keycode / 8] |= (uint8_t)(1u << (keycode % 8));
+    }
+  }
+
   return report;
-}
\ No newline at end of file
+}
+
+kb_hid_payload_t KB_HOT_FUNC(build_kb_hid_payload)(kb_pressed_keycodes_t kb_status){
+  kb_hid_payload_t payload;
+  memset(&payload, 0, sizeof(payload));
+
+  kb_report_t report = parse_kb_report(kb_status);
+  payload.num_of_keycodes = kb_status.num_of_keycodes;
+  payload.mouse_keys = report.mouse_keys;
+
+  // Media keys replace the keyboard report while they are held
+  if((report.fn_pressed != 0) && (report.media_key != 0)){
+    payload.consumer = report.media_key;
+  }
+
+  if((kb_status.num_of_keycodes != 0) && (report.media_key == 0)){
+    payload.boot.modifier = report.modifier;
+    memcpy(payload.boot.keycode, report.keycode, sizeof(payload.boot.keycode));
+
+    payload.nkro.modifier = report.modifier;
+    memcpy(payload.nkro.keys, report.nkro_keys, sizeof(payload.nkro.keys));
+  }
+
+  return payload;
+}
+
+// True if going from one payload to the other only releases keys. Only the keyboard report
+// of the protocol in use is compared, the other one is never sent. Core0 merges such payloads
+// while an endpoint is busy
+bool kb_hid_payload_only_releases(kb_hid_payload_t const* from, kb_hid_payload_t const* to, bool boot_protocol){
+  if(to->consumer & ~from->consumer) return false;
+  if(to->mouse_keys & ~from->mouse_keys) return false;
+
+  if(boot_protocol){
+    if(to->boot.modifier & ~from->boot.modifier) return false;
+
+    // Boot report lists keys by position, every key of 'to' has to be in 'from' already
+    for(uint i = 0; i < sizeof(to->boot.keycode); i++){
+      if(to->boot.keycode[i] == HID_KEY_NONE) continue;
+      if(memchr(from->boot.keycode, to->boot.keycode[i], sizeof(from->boot.keycode)) == NULL) return false;
+    }
+  }else{
+    if(to->nkro.modifier & ~from->nkro.modifier) return false;
+
+    for(uint i = 0; i < sizeof(to->nkro.keys); i++){
+      if(to->nkro.keys[i] & ~from->nkro.keys[i]) return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,92 @@
+#include <string.h>
+#include "kb_mouse.h"
+
+void kb_mouse_reset(kb_mouse_t* mouse){
+  memset(mouse, 0, sizeof(*mouse));
+}
+
+// 3u^2 - 2u^3, u and the result in Q8.8 between 0 and 1
+static int32_t smoothstep_q8(int32_t u_q8){
+  return (u_q8 * u_q8 * (3 * 256 - 2 * u_q8)) >> 16;
+}
+
+// Takes the whole pixels out of a remainder, rounding towards zero
+static int8_t take_whole(int32_t* acc_q8){
+  int32_t whole = *acc_q8 / 256;
+  if(whole > 127) whole = 127;
+  if(whole < -127) whole = -127;
+  *acc_q8 -= whole * 256;
+  return (int8_t) whole;
+}
+
+static int32_t key_direction(uint16_t mouse_keys, uint16_t positive, uint16_t negative){
+  return ((mouse_keys & positive) ? 1 : 0) - ((mouse_keys & negative) ? 1 : 0);
+}
+
+// An axis that starts moving or turns gets a whole pixel on its first step: at
+// KB_MOUSE_SPEED_MIN_Q8 the remainder alone only reaches one every 5 ms
+static void seed_whole(int32_t* acc_q8, int32_t dir, int32_t prev_dir){
+  if((dir != 0) && (dir != prev_dir) && (dir * *acc_q8 < 256)) *acc_q8 = dir * 256;
+}
+
+bool kb_mouse_step(kb_mouse_t* mouse, uint16_t mouse_keys, uint32_t now_us, kb_mouse_motion_t* motion){
+  memset(motion, 0, sizeof(*motion));
+
+  // HID: x grows to the right, y grows downwards, a positive wheel scrolls up
+  int32_t const dir_x = key_direction(mouse_keys, KB_MOUSE_RIGHT, KB_MOUSE_LEFT);
+  int32_t const dir_y = key_direction(mouse_keys, KB_MOUSE_DOWN, KB_MOUSE_UP);
+  int32_t const dir_wheel = key_direction(mouse_keys, KB_MOUSE_WHEEL_UP, KB_MOUSE_WHEEL_DOWN);
+
+  // Remainders of an axis no longer driven are dropped, so a new movement starts clean
+  if(dir_x == 0) mouse->x_q8 = 0;
+  if(dir_y == 0) mouse->y_q8 = 0;
+  if(dir_wheel == 0) mouse->wheel_q8 = 0;
+
+  if((dir_x == 0) && (dir_y == 0) && (dir_wheel == 0)){
+    mouse->moving = false;
+    mouse->move_rem = 0;
+    mouse->wheel_rem = 0;
+    mouse->keys = mouse_keys;
+    return false;
+  }
+
+  // The first step of a movement counts as one frame
+  uint32_t step_us = 1000;
+  if(!mouse->moving){
+    mouse->moving = true;
+    mouse->start_us = now_us;
+  }else{
+    step_us = now_us - mouse->last_us;
+    if(step_us > KB_MOUSE_MAX_STEP_US) step_us = KB_MOUSE_MAX_STEP_US;
+  }
+  mouse->last_us = now_us;
+
+  uint32_t const held_ms = (now_us - mouse->start_us) / 1000;
+  int32_t const u_q8 = (held_ms >= KB_MOUSE_ACCEL_MS) ? 256 : (int32_t) ((held_ms * 256) / KB_MOUSE_ACCEL_MS);
+  int32_t speed_q8 = KB_MOUSE_SPEED_MIN_Q8 + (((KB_MOUSE_SPEED_MAX_Q8 - KB_MOUSE_SPEED_MIN_Q8) * smoothstep_q8(u_q8)) >> 8);
+  // Same speed on diagonals, 181/256 ~ 1/sqrt(2)
+  if((dir_x != 0) && (dir_y != 0)) speed_q8 = (speed_q8 * 181) >> 8;
+
+  // Steps can be a few us apart when nothing was sent, the division remainder is carried over
+  uint32_t const move_scaled = (uint32_t) speed_q8 * step_us + mouse->move_rem;
+  mouse->move_rem = move_scaled % 1000;
+  int32_t const distance_q8 = (int32_t) (move_scaled / 1000);
+  uint32_t const wheel_scaled = KB_MOUSE_WHEEL_SPEED_Q8 * step_us + mouse->wheel_rem;
+  mouse->wheel_rem = wheel_scaled % 1000;
+
+  mouse->x_q8 += dir_x * distance_q8;
+  mouse->y_q8 += dir_y * distance_q8;
+  mouse->wheel_q8 += dir_wheel * (int32_t) (wheel_scaled / 1000);
+
+  // A press moves at once
+  seed_whole(&mouse->x_q8, dir_x, key_direction(mouse->keys, KB_MOUSE_RIGHT, KB_MOUSE_LEFT));
+  seed_whole(&mouse->y_q8, dir_y, key_direction(mouse->keys, KB_MOUSE_DOWN, KB_MOUSE_UP));
+  seed_whole(&mouse->wheel_q8, dir_wheel, key_direction(mouse->keys, KB_MOUSE_WHEEL_UP, KB_MOUSE_WHEEL_DOWN));
+  mouse->keys = mouse_keys;
+
+  motion->x = take_whole(&mouse->x_q8);
+  motion->y = take_whole(&mouse->y_q8);
+  motion->wheel = take_whole(&mouse->wheel_q8);
+
+  return (motion->x != 0) || (motion->y != 0) || (motion->wheel != 0);
+}
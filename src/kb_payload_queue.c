@@ -0,0 +1,38 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "kb_payload_queue.h"
+
+void kb_payload_queue_init(kb_payload_queue_t* queue){
+  memset(queue, 0, sizeof(*queue));
+}
+
+bool KB_HOT_FUNC(kb_payload_queue_push)(kb_payload_queue_t* queue, kb_hid_payload_t const* payload){
+  uint32_t const wr = queue->wr;
+  if(wr - queue->rd >= KB_PAYLOAD_QUEUE_LEN) return false;
+
+  queue->entries[wr % KB_PAYLOAD_QUEUE_LEN] = *payload;
+  // The entry is complete before the consumer can see it counted
+  __dmb();
+  queue->wr = wr + 1;
+  return true;
+}
+
+bool kb_payload_queue_peek(kb_payload_queue_t* queue, kb_hid_payload_t* payload){
+  uint32_t const rd = queue->rd;
+  if(queue->wr == rd) return false;
+
+  // Counted before read: the entry is only read after the producer finished it
+  __dmb();
+  *payload = queue->entries[rd % KB_PAYLOAD_QUEUE_LEN];
+  return true;
+}
+
+bool kb_payload_queue_pop(kb_payload_queue_t* queue, kb_hid_payload_t* payload){
+  if(!kb_payload_queue_peek(queue, payload)) return false;
+
+  // The entry is read before the producer can reuse it
+  __dmb();
+  queue->rd = queue->rd + 1;
+  return true;
+}
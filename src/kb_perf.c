@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "kb_matrix.h"
+#include "kb_perf.h"
+
+void kb_period_reset(kb_period_stats_t* stats){
+  memset(stats, 0, sizeof(*stats));
+  stats->min_us = UINT32_MAX;
+}
+
+void KB_HOT_FUNC(kb_period_add)(kb_period_stats_t* stats, uint32_t period_us){
+  if(period_us < stats->min_us) stats->min_us = period_us;
+  if(period_us > stats->max_us) stats->max_us = period_us;
+  stats->sum_us += period_us;
+  stats->sum_sq_us += (uint64_t) period_us * period_us;
+  stats->count ++;
+}
+
+void KB_HOT_FUNC(kb_period_tick)(kb_period_stats_t* stats, uint32_t now_us){
+  if(stats->started){
+    kb_period_add(stats, now_us - stats->last_us);
+  }
+  stats->started = true;
+  stats->last_us = now_us;
+}
+
+static uint32_t isqrt64(uint64_t value){
+  uint64_t res = 0;
+  uint64_t bit = (uint64_t) 1 << 62;
+  while(bit > value) bit >>= 2;
+  while(bit != 0){
+    if(value >= res + bit){
+      value -= res + bit;
+      res = (res >> 1) + bit;
+    }else{
+      res >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t) res;
+}
+
+void kb_period_print(char const* name, kb_period_stats_t const* stats){
+  if(stats->count == 0){
+    printf("%s: no samples\n", name);
+    return;
+  }
+  uint64_t const mean_us = stats->sum_us / stats->count;
+  uint64_t const mean_sq_us = stats->sum_sq_us / stats->count;
+  uint64_t const variance = (mean_sq_us > mean_us * mean_us) ? (mean_sq_us - mean_us * mean_us) : 0;
+  printf("%s: n=%lu mean=%lu us min=%lu us max=%lu us stddev=%lu us\n", name,
+         (unsigned long) stats->count, (unsigned long) mean_us, (unsigned long) stats->min_us,
+         (unsigned long) stats->max_us, (unsigned long) isqrt64(variance));
+}
+
+void kb_cycles_init(void){
+  systick_hw->rvr = 0x00FFFFFF;
+  systick_hw->cvr = 0;
+  // Enable, processor clock, no interrupt
+  systick_hw->csr = 0x5;
+}
+
+void KB_HOT_FUNC(kb_cycle_stats_add)(kb_cycle_stats_t* stats, uint32_t cycles){
+  stats->count ++;
+  stats->sum += cycles;
+  if(cycles > stats->max) stats->max = cycles;
+}
+
+void kb_cycle_stats_print(char const* name, kb_cycle_stats_t const* stats, kb_period_stats_t const* period){
+  if((stats->count == 0) || (period->count == 0)){
+    printf("%s: no samples\n", name);
+    return;
+  }
+  uint32_t const mean_cycles = (uint32_t) (stats->sum / stats->count);
+  uint64_t const period_cycles = (period->sum_us / period->count) * (clock_get_hz(clk_sys) / 1000000);
+  uint32_t const share_ppm = period_cycles ? (uint32_t) (((uint64_t) mean_cycles * 1000000) / period_cycles) : 0;
+  printf("%s: mean=%lu cycles max=%lu cycles (%lu ppm of the period)\n", name,
+         (unsigned long) mean_cycles, (unsigned long) stats->max, (unsigned long) share_ppm);
+}
+
+// Zero: phase not reached yet
+static volatile uint32_t kb_boot_ts_us[KB_BOOT_NUM_OF_PHASES];
+
+static char const* const kb_boot_phase_names[KB_BOOT_NUM_OF_PHASES] =
+{
+  "matrix init",
+  "core1 launched",
+  "board init",
+  "usb init",
+  "first scan",
+  "mounted",
+  "first report",
+};
+
+// Only the first time a phase is reached is recorded
+void KB_HOT_FUNC(kb_boot_mark)(uint8_t phase){
+  if((phase < KB_BOOT_NUM_OF_PHASES) && (kb_boot_ts_us[phase] == 0)){
+    kb_boot_ts_us[phase] = time_us_32();
+  }
+}
+
+uint32_t kb_boot_time_us(uint8_t phase){
+  return (phase < KB_BOOT_NUM_OF_PHASES) ? kb_boot_ts_us[phase] : 0;
+}
+
+void kb_boot_print(void){
+  uint32_t prev_us = 0;
+  printf("boot phases (from timer start, bootrom and boot2 not included):\n");
+  for(uint8_t phase = 0; phase < KB_BOOT_NUM_OF_PHASES; phase++){
+    uint32_t const ts_us = kb_boot_ts_us[phase];
+    if(ts_us == 0){
+      printf("  %-15s not reached\n", kb_boot_phase_names[phase]);
+      continue;
+    }
+    // Phases on the two cores may finish out of order, hence a signed delta
+    printf("  %-15s %8lu us (%+ld us)\n", kb_boot_phase_names[phase],
+           (unsigned long) ts_us, (long) (int32_t) (ts_us - prev_us));
+    prev_us = ts_us;
+  }
+}
@@ -0,0 +1,285 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "kb_split.h"
+
+#if KB_SPLIT_ENABLED
+
+TU_VERIFY_STATIC(KB_NUM_OF_ROWS <= 8, "MATRIX frame row present mask is one byte");
+TU_VERIFY_STATIC(KB_SPLIT_MAX_PAYLOAD_LEN <= 0x0F, "Payload length must fit the LEN nibble");
+
+static kb_split_stats_t split_stats;
+static uint8_t tx_seq;
+
+//--------------------------------------------------------------------+
+// Receiver state
+//--------------------------------------------------------------------+
+
+enum
+{
+  RX_WAIT_SOF,
+  RX_SEQ,
+  RX_TYPE_LEN,
+  RX_PAYLOAD,
+  RX_CRC,
+};
+
+static struct
+{
+  uint8_t state;
+  uint8_t crc;
+  uint8_t seq;
+  uint8_t type;
+  uint8_t len;
+  uint8_t idx;
+  uint8_t payload[KB_SPLIT_MAX_PAYLOAD_LEN];
+} rx;
+
+// Primary: matrix of the secondary half, written from the RX interrupt
+static kb_matrix_t remote_matrix;
+// Microseconds: the SDK's 64-bit time functions live in flash, spans here are seconds at most
+static uint32_t remote_last_rx_us;
+static bool remote_link_up = false;
+static bool rx_seq_valid = false;
+#if !KB_SPLIT_SECONDARY
+static uint8_t rx_expected_seq;
+#endif
+static uint32_t last_ping_us;
+
+// Secondary: matrix last sent to the primary
+static kb_matrix_t sent_matrix;
+static volatile bool full_sync_requested = true;
+static uint32_t last_sync_ms;
+
+static uint8_t crc8_update(uint8_t crc, uint8_t data){
+  crc ^= data;
+  for(int bit = 0; bit < 8; bit++){
+    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  }
+  return crc;
+}
+
+static void send_frame(uint8_t type, uint8_t const* payload, uint8_t len){
+  uint8_t frame[KB_SPLIT_MAX_FRAME_LEN];
+
+  // Frames are sent both from the scan loop and from the RX interrupt, keep them from interleaving
+  uint32_t save = save_and_disable_interrupts();
+
+  frame[0] = KB_SPLIT_SOF;
+  frame[1] = tx_seq++;
+  frame[2] = (uint8_t)((type << 4) | len);
+  memcpy(&frame[3], payload, len);
+
+  uint8_t crc = 0;
+  for(uint i = 1; i < 3u + len; i++){
+    crc = crc8_update(crc, frame[i]);
+  }
+  frame[3 + len] = crc;
+
+  kb_split_port_write(frame, 4u + len);
+  split_stats.frames_tx++;
+
+  restore_interrupts(save);
+}
+
+#if !KB_SPLIT_SECONDARY
+// Primary: a frame was lost or malformed, ask the secondary for all of its rows
+static void request_full_sync(void){
+  send_frame(KB_SPLIT_FRAME_NAK, NULL, 0);
+}
+
+static void apply_matrix_payload(void){
+  uint8_t const present = rx.payload[0];
+
+  // Drop malformed frames instead of applying a partial matrix
+  uint expected_len = 1;
+  for(int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    if(present & (1u << row_idx)) expected_len += 2;
+  }
+  if((rx.len == 0) || (rx.len != expected_len) || (present >> KB_NUM_OF_ROWS)){
+    split_stats.crc_errors++;
+    request_full_sync();
+    return;
+  }
+
+  uint idx = 1;
+  for(int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    if(present & (1u << row_idx)){
+      remote_matrix.rows[row_idx] = (kb_row_mask_t)(rx.payload[idx] | (rx.payload[idx + 1] << 8));
+      idx += 2;
+    }
+  }
+}
+#endif
+
+static void handle_frame(void){
+  split_stats.frames_rx++;
+
+#if !KB_SPLIT_SECONDARY
+  remote_last_rx_us = time_us_32();
+  remote_link_up = true;
+
+  // A gap means a delta was lost: row values are absolute, so this frame is still applied,
+  // but rows changed by the lost frame are only recovered by a full sync
+  if(rx_seq_valid && (rx.seq != rx_expected_seq)){
+    split_stats.seq_errors++;
+    request_full_sync();
+  }
+  rx_seq_valid = true;
+  rx_expected_seq = (uint8_t)(rx.seq + 1);
+#endif
+
+  switch(rx.type){
+#if KB_SPLIT_SECONDARY
+    case KB_SPLIT_FRAME_NAK:{
+      full_sync_requested = true;
+      break;
+    }
+    case KB_SPLIT_FRAME_PING:{
+      send_frame(KB_SPLIT_FRAME_PONG, rx.payload, rx.len);
+      break;
+    }
+#else
+    case KB_SPLIT_FRAME_MATRIX:{
+      apply_matrix_payload();
+      break;
+    }
+    case KB_SPLIT_FRAME_PONG:{
+      if(rx.len == sizeof(uint32_t)){
+        uint32_t ping_us;
+        memcpy(&ping_us, rx.payload, sizeof(ping_us));
+        split_stats.latency_us = (time_us_32() - ping_us) / 2;
+        if(split_stats.latency_us > split_stats.max_latency_us){
+          split_stats.max_latency_us = split_stats.latency_us;
+        }
+        if(split_stats.latency_us > KB_SPLIT_LATENCY_BUDGET_US) split_stats.over_budget++;
+      }
+      break;
+    }
+#endif
+    default: break;
+  }
+}
+
+// Frames are parsed byte by byte, so bytes lost on the wire only cost the frames they were in
+void kb_split_rx_byte(uint8_t byte){
+  switch(rx.state){
+    case RX_WAIT_SOF:{
+      if(byte == KB_SPLIT_SOF){
+        rx.crc = 0;
+        rx.state = RX_SEQ;
+      }
+      break;
+    }
+    case RX_SEQ:{
+      rx.seq = byte;
+      rx.crc = crc8_update(rx.crc, byte);
+      rx.state = RX_TYPE_LEN;
+      break;
+    }
+    case RX_TYPE_LEN:{
+      rx.type = byte >> 4;
+      rx.len = byte & 0x0F;
+      rx.idx = 0;
+      rx.crc = crc8_update(rx.crc, byte);
+      if(rx.len > KB_SPLIT_MAX_PAYLOAD_LEN){
+        split_stats.crc_errors++;
+        rx.state = RX_WAIT_SOF;
+      }else{
+        rx.state = (rx.len != 0) ? RX_PAYLOAD : RX_CRC;
+      }
+      break;
+    }
+    case RX_PAYLOAD:{
+      rx.payload[rx.idx++] = byte;
+      rx.crc = crc8_update(rx.crc, byte);
+      if(rx.idx == rx.len) rx.state = RX_CRC;
+      break;
+    }
+    case RX_CRC:{
+      rx.state = RX_WAIT_SOF;
+      if(byte == rx.crc){
+        handle_frame();
+      }else{
+        split_stats.crc_errors++;
+#if !KB_SPLIT_SECONDARY
+        request_full_sync();
+#endif
+      }
+      break;
+    }
+    default:{
+      rx.state = RX_WAIT_SOF;
+      break;
+    }
+  }
+}
+
+//--------------------------------------------------------------------+
+// Public API
+//--------------------------------------------------------------------+
+
+// Must be called on the core that scans the matrix: the RX interrupt is enabled on the calling core
+void kb_split_init(void){
+  kb_split_port_init();
+}
+
+// Secondary: send the rows that changed since the last frame, or all of them when a sync is due
+void kb_split_send_matrix(kb_matrix_t const* matrix){
+  uint32_t const now_ms = to_ms_since_boot(get_absolute_time());
+  bool const full_sync = full_sync_requested || (now_ms - last_sync_ms >= KB_SPLIT_SYNC_INTERVAL_MS);
+
+  uint8_t payload[KB_SPLIT_MAX_PAYLOAD_LEN];
+  uint8_t len = 1;
+  payload[0] = 0;
+
+  for(int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    if(full_sync || (matrix->rows[row_idx] != sent_matrix.rows[row_idx])){
+      payload[0] |= (uint8_t)(1u << row_idx);
+      payload[len++] = (uint8_t)(matrix->rows[row_idx] & 0xFF);
+      payload[len++] = (uint8_t)(matrix->rows[row_idx] >> 8);
+    }
+  }
+
+  // Nothing changed
+  if(payload[0] == 0) return;
+
+  if(full_sync){
+    full_sync_requested = false;
+    last_sync_ms = now_ms;
+    split_stats.full_syncs++;
+  }
+  sent_matrix = *matrix;
+
+  send_frame(KB_SPLIT_FRAME_MATRIX, payload, len);
+}
+
+// Primary: OR the keys of the secondary half into the locally scanned matrix
+void KB_HOT_FUNC(kb_split_merge_remote)(kb_matrix_t* matrix){
+  uint32_t const now_us = time_us_32();
+
+  uint32_t save = save_and_disable_interrupts();
+  if(remote_link_up && (now_us - remote_last_rx_us > KB_SPLIT_LINK_TIMEOUT_MS * 1000)){
+    // Secondary is gone (cable pulled or reset), release all of its keys
+    memset(&remote_matrix, 0, sizeof(remote_matrix));
+    remote_link_up = false;
+    rx_seq_valid = false;
+    split_stats.link_timeouts++;
+  }
+  for(int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    matrix->rows[row_idx] |= remote_matrix.rows[row_idx];
+  }
+  restore_interrupts(save);
+
+  // Once a second. send_frame() is left in flash with KB_HOT_PATH_IN_RAM, in the scan loop only this call can miss the XIP cache
+  if(now_us - last_ping_us >= KB_SPLIT_PING_INTERVAL_MS * 1000){
+    last_ping_us = now_us;
+    send_frame(KB_SPLIT_FRAME_PING, (uint8_t const*) &now_us, sizeof(now_us));
+  }
+}
+
+kb_split_stats_t kb_split_get_stats(void){
+  return split_stats;
+}
+
+#endif // KB_SPLIT_ENABLED
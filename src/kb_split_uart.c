@@ -0,0 +1,31 @@
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "kb_split.h"
+
+#if KB_SPLIT_ENABLED
+
+static void on_uart_rx(void){
+  while(uart_is_readable(KB_SPLIT_UART)){
+    kb_split_rx_byte((uint8_t) uart_getc(KB_SPLIT_UART));
+  }
+}
+
+void kb_split_port_init(void){
+  uart_init(KB_SPLIT_UART, KB_SPLIT_BAUD_RATE);
+  gpio_set_function(KB_SPLIT_UART_TX_PIN, GPIO_FUNC_UART);
+  gpio_set_function(KB_SPLIT_UART_RX_PIN, GPIO_FUNC_UART);
+  uart_set_hw_flow(KB_SPLIT_UART, false, false);
+  uart_set_format(KB_SPLIT_UART, 8, 1, UART_PARITY_NONE);
+  uart_set_fifo_enabled(KB_SPLIT_UART, true);
+
+  irq_set_exclusive_handler(KB_SPLIT_UART_IRQ, on_uart_rx);
+  irq_set_enabled(KB_SPLIT_UART_IRQ, true);
+  uart_set_irq_enables(KB_SPLIT_UART, true, false);
+}
+
+void kb_split_port_write(uint8_t const* data, uint len){
+  uart_write_blocking(KB_SPLIT_UART, data, len);
+}
+
+#endif // KB_SPLIT_ENABLED
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+#include "kb_matrix.h"
+#include "kb_trace.h"
+
+#if KB_TRACE
+
+typedef struct
+{
+  uint32_t start_us;
+  uint32_t end_us;
+  uint32_t flow_id : 24;
+  uint32_t stage : 8;
+} kb_trace_event_t;
+
+enum
+{
+  TRACE_IDLE,
+  TRACE_ARMED,      /**< Mounted, waiting for the first key edge. */
+  TRACE_RECORDING,
+  TRACE_FULL,       /**< A buffer is full or the capture time is over, the other core may still finish its last event. */
+  TRACE_DUMPING,
+  TRACE_DONE,
+};
+
+static char const* const trace_stage_names[KB_TRACE_NUM_OF_STAGES] =
+{
+  "scan",
+  "debounce",
+  "layer",
+  "enqueue",
+  "usb task",
+  "report",
+  "poll",
+};
+
+// One buffer per core, each only written by its own core
+static kb_trace_event_t trace_events[2][KB_TRACE_LEN];
+static volatile uint trace_count[2];
+static volatile uint8_t trace_state = TRACE_IDLE;
+// Set by either core when its buffer is full. Only core0 moves trace_state on from RECORDING,
+// a store from core1 could otherwise undo the switch to DUMPING
+static volatile bool trace_buffer_full = false;
+static volatile uint32_t trace_start_us;
+
+// Core1 slices of the current scan pass, most passes change nothing and are dropped
+#define TRACE_PASS_LEN 4
+static kb_trace_event_t trace_pass[TRACE_PASS_LEN];
+static uint trace_pass_count = 0;
+
+// Dump progress, core0 only
+static uint dump_count[2];
+static uint dump_core;
+static uint dump_idx;
+
+static void KB_HOT_FUNC(trace_event_set)(kb_trace_event_t* event, uint8_t stage, uint32_t start_us, uint32_t end_us, uint32_t flow_id){
+  event->start_us = start_us;
+  event->end_us = end_us;
+  event->flow_id = flow_id & 0x00FFFFFF;
+  event->stage = stage;
+}
+
+static void KB_HOT_FUNC(trace_record)(uint8_t stage, uint32_t start_us, uint32_t end_us, uint32_t flow_id){
+  uint const core = get_core_num();
+  uint const idx = trace_count[core];
+  if(idx >= KB_TRACE_LEN){
+    trace_buffer_full = true;
+    return;
+  }
+
+  trace_event_set(&trace_events[core][idx], stage, start_us, end_us, flow_id);
+  // The event is complete before core0 can see it counted
+  __dmb();
+  trace_count[core] = idx + 1;
+}
+
+static bool KB_HOT_FUNC(is_pass_stage)(uint8_t stage){
+  return (stage == KB_TRACE_SCAN) || (stage == KB_TRACE_DEBOUNCE) || (stage == KB_TRACE_LAYER);
+}
+
+void KB_HOT_FUNC(kb_trace_slice)(uint8_t stage, uint32_t start_us, uint32_t end_us, uint32_t flow_id){
+  uint8_t const state = trace_state;
+  if((state != TRACE_ARMED) && (state != TRACE_RECORDING)) return;
+
+  if(is_pass_stage(stage)){
+    if(trace_pass_count < TRACE_PASS_LEN){
+      trace_event_set(&trace_pass[trace_pass_count++], stage, start_us, end_us, flow_id);
+    }
+    return;
+  }
+
+  // The first payload change after mount starts the capture
+  if(state == TRACE_ARMED){
+    if(stage != KB_TRACE_ENQUEUE) return;
+    trace_start_us = start_us;
+    __dmb();
+    trace_state = TRACE_RECORDING;
+  }
+  trace_record(stage, start_us, end_us, flow_id);
+}
+
+void KB_HOT_FUNC(kb_trace_pass_end)(bool payload_changed){
+  if(payload_changed && (trace_state == TRACE_RECORDING)){
+    for(uint i = 0; i < trace_pass_count; i++){
+      trace_record(trace_pass[i].stage, trace_pass[i].start_us, trace_pass[i].end_us, trace_pass[i].flow_id);
+    }
+  }
+  trace_pass_count = 0;
+}
+
+// Flows go from the enqueue through the reports to the poll of the same payload
+static char const* flow_phase(uint8_t stage){
+  switch(stage){
+    case KB_TRACE_ENQUEUE: return "s";
+    case KB_TRACE_REPORT:  return "t";
+    case KB_TRACE_POLL:    return "f";
+    default:               return NULL;
+  }
+}
+
+static void dump_event(uint core, kb_trace_event_t const* event){
+  printf(",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lu,\"dur\":%lu}\n",
+         trace_stage_names[event->stage], core, (unsigned long) event->start_us,
+         (unsigned long) (event->end_us - event->start_us));
+
+  char const* phase = flow_phase(event->stage);
+  if((event->flow_id != 0) && (phase != NULL)){
+    printf(",{\"name\":\"payload\",\"cat\":\"payload\",\"ph\":\"%s\",\"bp\":\"e\",\"id\":%lu,\"pid\":1,\"tid\":%u,\"ts\":%lu}\n",
+           phase, (unsigned long) event->flow_id, core, (unsigned long) event->start_us);
+  }
+}
+
+// Printing blocks on stdio, so only one event goes out per call and USB keeps being serviced
+void kb_trace_task(void){
+  switch(trace_state){
+    case TRACE_IDLE:{
+      if(tud_mounted()) trace_state = TRACE_ARMED;
+      break;
+    }
+    case TRACE_RECORDING:{
+      if(trace_buffer_full || (time_us_32() - trace_start_us >= KB_TRACE_CAPTURE_MS * 1000)) trace_state = TRACE_FULL;
+      break;
+    }
+    case TRACE_FULL:{
+      dump_count[0] = trace_count[0];
+      dump_count[1] = trace_count[1];
+      dump_core = 0;
+      dump_idx = 0;
+      trace_state = TRACE_DUMPING;
+
+      printf("{\"traceEvents\":[\n");
+      printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"core0 (USB)\"}}\n");
+      printf(",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"core1 (scan)\"}}\n");
+      break;
+    }
+    case TRACE_DUMPING:{
+      while((dump_core < 2) && (dump_idx >= dump_count[dump_core])){
+        dump_core ++;
+        dump_idx = 0;
+      }
+      if(dump_core < 2){
+        dump_event(dump_core, &trace_events[dump_core][dump_idx]);
+        dump_idx ++;
+      }else{
+        printf("]}\n");
+        trace_state = TRACE_DONE;
+      }
+      break;
+    }
+    default: break;
+  }
+}
+
+#endif // KB_TRACE
@@ -0,0 +1,49 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "kb_wake_queue.h"
+
+void kb_wake_queue_clear(kb_wake_queue_t* queue){
+  queue->head = 0;
+  queue->count = 0;
+  queue->resumed = false;
+}
+
+void kb_wake_queue_push(kb_wake_queue_t* queue, kb_hid_payload_t const* payload){
+  uint idx;
+  if(queue->count < KB_WAKE_QUEUE_LEN){
+    idx = (queue->head + queue->count) % KB_WAKE_QUEUE_LEN;
+    queue->count++;
+  }else{
+    idx = (queue->head + KB_WAKE_QUEUE_LEN - 1) % KB_WAKE_QUEUE_LEN;
+  }
+  queue->payloads[idx] = *payload;
+}
+
+void kb_wake_queue_resume(kb_wake_queue_t* queue, uint32_t now_ms){
+  queue->resume_ms = now_ms;
+  queue->resumed = true;
+}
+
+bool kb_wake_queue_peek(kb_wake_queue_t* queue, uint32_t now_ms, kb_hid_payload_t* payload){
+  if(queue->count == 0) return false;
+
+  if(!queue->resumed) kb_wake_queue_resume(queue, now_ms);
+  if(now_ms - queue->resume_ms > KB_WAKE_REPLAY_TIMEOUT_MS){
+    queue->count = 0;
+    return false;
+  }
+
+  *payload = queue->payloads[queue->head];
+  return true;
+}
+
+void kb_wake_queue_pop(kb_wake_queue_t* queue){
+  if(queue->count == 0) return;
+
+  queue->head = (queue->head + 1) % KB_WAKE_QUEUE_LEN;
+  queue->count--;
+}
+
+uint kb_wake_queue_count(kb_wake_queue_t const* queue){
+  return queue->count;
+}
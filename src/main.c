@@ -32,9 +32,19 @@
 
 #include "usb_descriptors.h"
 
+#include "pico/stdlib.h"
 #include "pico/multicore.h"
 
 #include "main.h"
+#include "kb_split.h"
+#include "kb_perf.h"
+#include "kb_heatmap.h"
+#include "kb_mouse.h"
+#include "kb_trace.h"
+#include "kb_clock.h"
+#include "kb_payload_queue.h"
+#include "kb_wake_queue.h"
+#include "pico/flash.h"
 
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF PROTYPES
@@ -55,47 +65,247 @@ static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 
 void led_blinking_task(void);
 void hid_task(void);
+#if KB_PERF_LOG
+static void perf_log_task(void);
+#endif
 
 void core1_entry();
-
-kb_pressed_keycodes_t core1_kb_status;
-auto_init_mutex(my_mutex);
+void core1_scan_task(void);
+
+// Every payload change on core1 is queued to core0, which sends them one after the other,
+// so a tap shorter than a USB poll still gives a press report and then a release report.
+// The queue only fills up if core0 is stalled, the latest state is then kept and retried.
+static kb_payload_queue_t hid_payload_queue;
+// States that never made it into the queue, and release-only payloads merged on core0
+static uint32_t hid_payload_overflows = 0;
+static uint32_t hid_payload_coalesced = 0;
+// Payloads queued by core1 and taken by core0, the queue is FIFO so the counts pair them up.
+// A payload's count is its flow id in the trace
+static uint32_t hid_payload_queued_count = 0;
+static uint32_t hid_payload_taken_count = 0;
+
+static kb_period_stats_t core0_loop_stats;
+static kb_period_stats_t core1_scan_stats;
+static kb_cycle_stats_t heatmap_cycle_stats;
+// Mouse report cadence while the pointer moves, and the cost of a motion step on core0
+static kb_period_stats_t mouse_report_stats;
+static kb_cycle_stats_t mouse_step_cycle_stats;
+
+// Boot key held at plug-in: the heatmap counts a scratch session, neither loaded nor saved, and the
+// statistics log stays quiet. Nothing it skips runs before enumeration, the heatmap is loaded on
+// core1 while core0 enumerates
+static bool boot_key_held = false;
+
+// What the host has last received, zero: nothing pressed
+static kb_hid_payload_t hid_sent;
+
+// Time from handing a report to an endpoint until the host polled it, per HID instance.
+// With a 1 ms bInterval this is at most a frame plus the tud_task() delay on core0
+static uint32_t hid_report_sent_us[ITF_NUM_TOTAL];
+static kb_period_stats_t hid_poll_stats[ITF_NUM_TOTAL];
+static uint32_t hid_report_flow_id[ITF_NUM_TOTAL];
+static char const* const hid_itf_names[] = { "boot", "nkro", "consumer", "feature", "mouse" };
+TU_VERIFY_STATIC(sizeof(hid_itf_names) / sizeof(hid_itf_names[0]) == ITF_NUM_TOTAL, "Every HID interface needs a name");
+
+// Pointer motion of the mouse keys, stepped on core0 on every frame the mouse endpoint is free
+static kb_mouse_t mouse;
+
+// Payload changes seen while the bus is suspended, replayed after resume
+static kb_wake_queue_t wake_queue;
+static bool remote_wakeup_allowed = false;
+
+// Time from tud_resume_cb() to the first report of the replay
+static uint32_t resume_us;
+static bool resume_report_pending = false;
+static uint32_t resume_to_report_us = 0;
+static uint32_t resume_to_report_max_us = 0;
 
 /*------------- MAIN -------------*/
 int main(void)
 {
+#if KB_CLOCK_SCALING
+  kb_clock_init();
+#endif
   init_kb_matrix();
+  kb_boot_mark(KB_BOOT_MATRIX_INIT);
+
+  boot_key_held = read_kb_key(KB_BOOT_KEY_ROW, KB_BOOT_KEY_COL);
+
+#if KB_SPLIT_ENABLED && KB_SPLIT_SECONDARY
+  // The secondary half is not connected to USB, it only streams its matrix to the primary one
+  kb_split_init();
+  while (1)
+  {
+    kb_matrix_t matrix;
+    scan_kb_matrix(&matrix);
+    kb_split_send_matrix(&matrix);
+  }
+#endif
+
+  kb_period_reset(&core0_loop_stats);
+  kb_period_reset(&core1_scan_stats);
+  kb_period_reset(&mouse_report_stats);
+  for (uint i = 0; i < ITF_NUM_TOTAL; i++) kb_period_reset(&hid_poll_stats[i]);
+
+  kb_payload_queue_init(&hid_payload_queue);
+
+  // Core1 saves the heatmap to flash, which needs this core parked meanwhile
+  flash_safe_execute_core_init();
+
+  // Scanning starts before USB init and enumeration, keys held at plug-in are
+  // already in the payload when the host configures the device
+  multicore_launch_core1(core1_entry);
+  kb_boot_mark(KB_BOOT_CORE1_LAUNCHED);
+
   board_init();
+  kb_boot_mark(KB_BOOT_BOARD_INIT);
 
   // init device stack on configured roothub port
   tud_init(BOARD_TUD_RHPORT);
+  kb_boot_mark(KB_BOOT_USB_INIT);
+
+  // Mouse steps are timed in cycles on this core
+  kb_cycles_init();
 
   if (board_init_after_tusb) {
     board_init_after_tusb();
   }
 
-  multicore_launch_core1(core1_entry);
-
+  // Reports are built on core1, this loop only services USB
   while (1)
   {
+    // Only calls with something to process are traced, idle ones would fill the trace
+    bool const usb_event = KB_TRACE && tud_task_event_ready();
+    uint32_t const usb_task_start_us = kb_trace_now();
     tud_task(); // tinyusb device task
+    if (usb_event) kb_trace_slice(KB_TRACE_USB_TASK, usb_task_start_us, kb_trace_now(), 0);
     led_blinking_task();
 
     hid_task();
+    kb_trace_task();
+#if KB_CLOCK_SCALING
+    kb_clock_task();
+#endif
+
+    kb_period_tick(&core0_loop_stats, time_us_32());
+#if KB_PERF_LOG
+    if (!boot_key_held) perf_log_task();
+#endif
   }
 }
 
+// Core1 loop state between two scans
+static kb_hid_payload_t core1_last_payload;
+static bool core1_last_payload_queued = true;
+// Millisecond clock of the loop, advanced from the 32-bit timer:
+// the SDK's 64-bit time functions and divisions live in flash
+static uint32_t core1_now_ms;
+static uint32_t core1_ms_tick_us;
+
+void KB_HOT_FUNC(core1_entry)(){
+#if KB_SPLIT_ENABLED
+  // Remote matrix is received on this core, next to the scanner it is merged into
+  kb_split_init();
+#endif
+
+  kb_heatmap_init(boot_key_held);
+  kb_cycles_init();
+
+  core1_now_ms = to_ms_since_boot(get_absolute_time());
+  core1_ms_tick_us = time_us_32();
 
-void core1_entry(){
   while(true){
-    uint32_t owner_out;
-    kb_pressed_keycodes_t lcl_kb_status = get_kb_keycodes();
-    if (mutex_try_enter(&my_mutex,&owner_out)){
-      core1_kb_status = lcl_kb_status;
-      mutex_exit(&my_mutex);
+    core1_scan_task();
+  }
+}
+
+// One pass of the core1 loop: scan, build the reports and queue what changed to core0
+void KB_HOT_FUNC(core1_scan_task)(void){
+  kb_matrix_t matrix;
+  get_kb_matrix(&matrix);
+  while (time_us_32() - core1_ms_tick_us >= 1000){
+    core1_ms_tick_us += 1000;
+    core1_now_ms ++;
+  }
+
+  uint32_t const heatmap_start_cycles = kb_cycles_now();
+  kb_heatmap_update(&matrix, core1_now_ms);
+  kb_cycle_stats_add(&heatmap_cycle_stats, kb_cycles_elapsed(heatmap_start_cycles, kb_cycles_now()));
+
+  // Resolve the Fn layer and build the reports of all interfaces
+  uint32_t const layer_start_us = kb_trace_now();
+  kb_hid_payload_t payload = build_kb_hid_payload(kb_matrix_to_keycodes(&matrix));
+  kb_trace_slice(KB_TRACE_LAYER, layer_start_us, kb_trace_now(), 0);
+#if KB_CLOCK_SCALING
+  // Full clock is requested in the scan that sees the key
+  if (payload.num_of_keycodes != 0) kb_clock_activity(core1_now_ms);
+#endif
+  kb_period_tick(&core1_scan_stats, time_us_32());
+  kb_boot_mark(KB_BOOT_FIRST_SCAN);
+
+  // Queue changes only
+  bool const payload_changed = !kb_hid_payload_equal(&payload, &core1_last_payload);
+  if (payload_changed){
+    if (!core1_last_payload_queued) hid_payload_overflows ++;
+    core1_last_payload = payload;
+    core1_last_payload_queued = false;
+  }
+  if (!core1_last_payload_queued){
+    uint32_t const enqueue_start_us = kb_trace_now();
+    core1_last_payload_queued = kb_payload_queue_push(&hid_payload_queue, &core1_last_payload);
+    if (core1_last_payload_queued){
+      hid_payload_queued_count ++;
+      kb_trace_slice(KB_TRACE_ENQUEUE, enqueue_start_us, kb_trace_now(), hid_payload_queued_count);
     }
   }
+  kb_trace_pass_end(payload_changed);
+
+  kb_heatmap_task(core1_now_ms);
 }
+
+#if KB_PERF_LOG
+static void perf_log_task(void)
+{
+  static uint32_t start_ms = 0;
+  static bool boot_printed = false;
+
+  if (!boot_printed && kb_boot_time_us(KB_BOOT_FIRST_REPORT))
+  {
+    kb_boot_print();
+    boot_printed = true;
+  }
+
+  if ( board_millis() - start_ms < KB_PERF_LOG_INTERVAL_MS) return; // not enough time
+  start_ms += KB_PERF_LOG_INTERVAL_MS;
+
+  kb_period_print("core0 loop", &core0_loop_stats);
+  kb_period_print("core1 scan", &core1_scan_stats);
+  kb_cycle_stats_print("heatmap update", &heatmap_cycle_stats, &core1_scan_stats);
+  kb_period_print("mouse reports", &mouse_report_stats);
+  kb_cycle_stats_print("mouse step", &mouse_step_cycle_stats, &core0_loop_stats);
+  printf("payloads: overflows=%lu coalesced=%lu\n",
+         (unsigned long) hid_payload_overflows, (unsigned long) hid_payload_coalesced);
+  printf("resume to first report: last=%lu us max=%lu us\n",
+         (unsigned long) resume_to_report_us, (unsigned long) resume_to_report_max_us);
+#if KB_CLOCK_SCALING
+  kb_clock_print();
+#endif
+
+  for (uint i = 0; i < ITF_NUM_TOTAL; i++)
+  {
+    if (hid_poll_stats[i].count == 0) continue;
+    char name[32];
+    snprintf(name, sizeof(name), "%s report to poll", hid_itf_names[i]);
+    kb_period_print(name, &hid_poll_stats[i]);
+  }
+
+  // Printing takes far longer than a loop, keep it out of the next window.
+  // It also delays tud_task(), hence the completion callbacks
+  kb_period_reset(&core0_loop_stats);
+  for (uint i = 0; i < ITF_NUM_TOTAL; i++) kb_period_reset(&hid_poll_stats[i]);
+}
+#endif
+
 //--------------------------------------------------------------------+
 // Device callbacks
 //--------------------------------------------------------------------+
@@ -104,12 +314,16 @@ void core1_entry(){
 void tud_mount_cb(void)
 {
   blink_interval_ms = BLINK_MOUNTED;
+  kb_boot_mark(KB_BOOT_MOUNTED);
+  // A host that re-enumerates instead of resuming starts with nothing pressed
+  memset(&hid_sent, 0, sizeof(hid_sent));
 }
 
 // Invoked when device is unmounted
 void tud_umount_cb(void)
 {
   blink_interval_ms = BLINK_NOT_MOUNTED;
+  memset(&hid_sent, 0, sizeof(hid_sent));
 }
 
 // Invoked when usb bus is suspended
@@ -117,7 +331,11 @@ void tud_umount_cb(void)
 // Within 7ms, device must draw an average of current less than 2.5 mA from bus
 void tud_suspend_cb(bool remote_wakeup_en)
 {
-  (void) remote_wakeup_en;
+  // Keys are only queued if they can wake the host
+  remote_wakeup_allowed = remote_wakeup_en;
+  kb_wake_queue_clear(&wake_queue);
+  // The pointer does not jump on resume with what was held meanwhile
+  kb_mouse_reset(&mouse);
   blink_interval_ms = BLINK_SUSPENDED;
 }
 
@@ -125,135 +343,223 @@ void tud_suspend_cb(bool remote_wakeup_en)
 void tud_resume_cb(void)
 {
   blink_interval_ms = tud_mounted() ? BLINK_MOUNTED : BLINK_NOT_MOUNTED;
+
+  resume_us = time_us_32();
+  resume_report_pending = (kb_wake_queue_count(&wake_queue) != 0);
+  kb_wake_queue_resume(&wake_queue, board_millis());
 }
 
 //--------------------------------------------------------------------+
 // USB HID
 //--------------------------------------------------------------------+
 
-static void send_hid_report(uint8_t report_id, kb_pressed_keycodes_t kb_status)
+static void on_hid_report_sent(uint8_t instance, uint32_t flow_id)
 {
-  // // skip if hid is not ready yet
-  // if ( !tud_hid_ready() ) return;
-
-  // kb_report_t report = parse_kb_report(kb_status);
-
-  // switch(report_id)
-  // {
-  //   case REPORT_ID_KEYBOARD:
-  //   {
-  //     // use to avoid send multiple consecutive zero report for keyboard
-  //     static bool has_keyboard_key = false;
-
-  //     if((kb_status.num_of_keycodes != 0) && (report.media_key == 0))
-  //     {
-  //       tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report.modifier, report.keycode);
-  //       has_keyboard_key = true;
-  //     }else
-  //     {
-  //       // send empty key report if previously has key pressed
-  //       if (has_keyboard_key) tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, NULL);
-  //       has_keyboard_key = false;
-  //     }
-  //   }
-  //   break;
-
-  //   case REPORT_ID_CONSUMER_CONTROL:
-  //   {
-  //     // use to avoid send multiple consecutive zero report
-  //     static bool has_consumer_key = false;
-
-  //     if((report.fn_pressed != 0) && (report.media_key != 0))
-  //     {
-  //       // volume down
-  //       uint16_t volume_down = HID_USAGE_CONSUMER_VOLUME_DECREMENT;
-  //       tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &volume_down, 2);
-  //       has_consumer_key = true;
-  //     }else
-  //     {
-  //       // send empty key report (release key) if previously has key pressed
-  //       uint16_t empty_key = 0;
-  //       if (has_consumer_key) tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &empty_key, 2);
-  //       has_consumer_key = false;
-  //     }
-  //   }
-  //   break;
-
-  //   default: break;
-  // }
-
-  static bool prev_media_report_is_not_empty = false;
-  static bool prev_kb_report_is_not_empty = false;
-
-  kb_report_t report = parse_kb_report(kb_status);
+  kb_boot_mark(KB_BOOT_FIRST_REPORT);
+  hid_report_sent_us[instance] = time_us_32();
+  hid_report_flow_id[instance] = flow_id;
+  kb_trace_slice(KB_TRACE_REPORT, hid_report_sent_us[instance], hid_report_sent_us[instance], flow_id);
+
+  if (resume_report_pending)
+  {
+    resume_report_pending = false;
+    resume_to_report_us = time_us_32() - resume_us;
+    if (resume_to_report_us > resume_to_report_max_us) resume_to_report_max_us = resume_to_report_us;
+  }
+}
 
+// Sends the mouse buttons with the motion since the previous report.
+// Returns false if the report could not be sent
+static bool send_mouse_report(uint16_t mouse_keys, uint32_t flow_id)
+{
+  uint32_t const start_cycles = kb_cycles_now();
+  kb_mouse_motion_t motion;
+  bool const moved = kb_mouse_step(&mouse, mouse_keys, time_us_32(), &motion);
+  kb_cycle_stats_add(&mouse_step_cycle_stats, kb_cycles_elapsed(start_cycles, kb_cycles_now()));
+
+  uint8_t const buttons = (uint8_t) (mouse_keys >> KB_MOUSE_BUTTONS_SHIFT);
+  // Gaps between movements are not part of the report cadence
+  if (!mouse.moving) mouse_report_stats.started = false;
+  bool const buttons_changed = (buttons != (uint8_t) (hid_sent.mouse_keys >> KB_MOUSE_BUTTONS_SHIFT));
+  if (!moved && !buttons_changed) return true;
+
+  if (!tud_hid_n_mouse_report(ITF_NUM_MOUSE, 0, buttons, motion.x, motion.y, motion.wheel, 0)) return false;
+
+  if (moved) kb_period_tick(&mouse_report_stats, time_us_32());
+  // Motion-only reports do not belong to a payload
+  on_hid_report_sent(ITF_NUM_MOUSE, buttons_changed ? flow_id : 0);
+  return true;
+}
 
+// Sends every report that differs from what the host has last received.
+// A busy endpoint is simply retried on the next loop.
+// Returns true once the host is up to date with the payload.
+// flow_id: the payload's flow in the trace, 0 if it was not queued by core1
+static bool send_hid_payload(kb_hid_payload_t const* payload, uint32_t flow_id)
+{
   // Send media report
-  if(((report.fn_pressed != 0) && (report.media_key != 0)) || prev_media_report_is_not_empty){
-    tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &(report.media_key), sizeof(report.media_key));
+  if ((payload->consumer != hid_sent.consumer) && tud_hid_n_ready(ITF_NUM_CONSUMER))
+  {
+    if (tud_hid_n_report(ITF_NUM_CONSUMER, 0, &payload->consumer, sizeof(payload->consumer)))
+    {
+      hid_sent.consumer = payload->consumer;
+      on_hid_report_sent(ITF_NUM_CONSUMER, flow_id);
+    }
   }
-  prev_media_report_is_not_empty = ((report.fn_pressed != 0) && (report.media_key != 0)) ;
+  bool in_sync = (payload->consumer == hid_sent.consumer);
 
   //Send KB report
-  if(((kb_status.num_of_keycodes != 0) && (report.media_key == 0)) || prev_kb_report_is_not_empty){
-    tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report.modifier, report.keycode);
+  // BIOS/UEFI switches the boot interface to boot protocol and only reads that one,
+  // otherwise the NKRO interface is used and the boot interface stays idle
+  if (tud_hid_n_get_protocol(ITF_NUM_KEYBOARD) == HID_PROTOCOL_BOOT)
+  {
+    if ((memcmp(&payload->boot, &hid_sent.boot, sizeof(hid_sent.boot)) != 0) && tud_hid_n_ready(ITF_NUM_KEYBOARD))
+    {
+      if (tud_hid_n_report(ITF_NUM_KEYBOARD, 0, &payload->boot, sizeof(payload->boot)))
+      {
+        hid_sent.boot = payload->boot;
+        on_hid_report_sent(ITF_NUM_KEYBOARD, flow_id);
+      }
+    }
+    in_sync = in_sync && (memcmp(&payload->boot, &hid_sent.boot, sizeof(hid_sent.boot)) == 0);
+  }else
+  {
+    if ((memcmp(&payload->nkro, &hid_sent.nkro, sizeof(hid_sent.nkro)) != 0) && tud_hid_n_ready(ITF_NUM_NKRO))
+    {
+      if (tud_hid_n_report(ITF_NUM_NKRO, 0, &payload->nkro, sizeof(payload->nkro)))
+      {
+        hid_sent.nkro = payload->nkro;
+        on_hid_report_sent(ITF_NUM_NKRO, flow_id);
+      }
+    }
+    in_sync = in_sync && (memcmp(&payload->nkro, &hid_sent.nkro, sizeof(hid_sent.nkro)) == 0);
+  }
+
+  // Send mouse report
+  // Buttons follow the payload order like keys, motion is stepped on every frame the endpoint is free
+  if (tud_hid_n_ready(ITF_NUM_MOUSE) && send_mouse_report(payload->mouse_keys, flow_id))
+  {
+    hid_sent.mouse_keys = payload->mouse_keys;
+  }
+  in_sync = in_sync && (((payload->mouse_keys ^ hid_sent.mouse_keys) & KB_MOUSE_BUTTONS) == 0);
+
+  return in_sync;
+}
+
+// Sends the oldest queued event, returns false once nothing is left to replay
+static bool wake_queue_replay(void)
+{
+  kb_hid_payload_t event;
+  while (kb_wake_queue_peek(&wake_queue, board_millis(), &event))
+  {
+    if (!send_hid_payload(&event, 0)) return true;
+    kb_wake_queue_pop(&wake_queue);
   }
-  prev_kb_report_is_not_empty = ((kb_status.num_of_keycodes != 0) && (report.media_key == 0));
+  return false;
 }
 
-// Every 10ms, we will sent 1 report for each HID profile (keyboard, mouse etc ..)
-// tud_hid_report_complete_cb() is used to send the next report after previous one is complete
+// Sends the payloads queued by core1 in order: the next one is only taken once the host
+// has all of the current one. Each profile has its own interface and endpoint,
+// so reports of different profiles do not wait for each other
 void hid_task(void)
 {
-  // Poll every 10ms
-  const uint32_t interval_ms = 10;
-  static uint32_t start_ms = 0;
+  // Payload being sent, zero until core1 queues the first one
+  static kb_hid_payload_t payload;
+  static uint32_t payload_flow_id = 0;
+  kb_hid_payload_t next;
 
-  if ( board_millis() - start_ms < interval_ms) return; // not enough time
-  start_ms += interval_ms;
+  // Remote wakeup
+  if ( tud_suspended() )
+  {
+    while ( kb_payload_queue_pop(&hid_payload_queue, &next) )
+    {
+      hid_payload_taken_count ++;
+      if ( remote_wakeup_allowed )
+      {
+        kb_wake_queue_push(&wake_queue, &next);
 
-  //uint32_t const btn = board_button_read();
-  kb_pressed_keycodes_t kb_status;
-  uint32_t owner_out;
-  if (mutex_try_enter(&my_mutex,&owner_out)){
-    kb_status = core1_kb_status;
-    mutex_exit(&my_mutex);
+        // Wake up host if we are in suspend mode
+        // and REMOTE_WAKEUP feature is enabled by host
+        if ( next.num_of_keycodes != 0 ) tud_remote_wakeup();
+      }
+      payload = next;
+      payload_flow_id = 0;
+    }
+    return;
   }
 
-  // Remote wakeup
-  //if ( tud_suspended() && btn )
-  if ( tud_suspended() &&  (kb_status.num_of_keycodes != 0))
+  // Events queued while suspended go out first and in order, the live state follows
+  if ( wake_queue_replay() ) return;
+
+  if ( !send_hid_payload(&payload, payload_flow_id) )
   {
-    // Wake up host if we are in suspend mode
-    // and REMOTE_WAKEUP feature is enabled by host
-    tud_remote_wakeup();
-  }else
+    // Endpoint busy. Releases that directly follow other releases can be merged,
+    // that changes no press order and no key the host sees
+    bool const boot_protocol = (tud_hid_n_get_protocol(ITF_NUM_KEYBOARD) == HID_PROTOCOL_BOOT);
+    if ( kb_payload_queue_peek(&hid_payload_queue, &next) &&
+         kb_hid_payload_only_releases(&hid_sent, &payload, boot_protocol) &&
+         kb_hid_payload_only_releases(&payload, &next, boot_protocol) )
+    {
+      kb_payload_queue_pop(&hid_payload_queue, &payload);
+      payload_flow_id = ++hid_payload_taken_count;
+      hid_payload_coalesced ++;
+    }
+    return;
+  }
+
+  if ( kb_payload_queue_pop(&hid_payload_queue, &payload) )
   {
-    // Send the 1st of report chain, the rest will be sent by tud_hid_report_complete_cb()
-    send_hid_report(REPORT_ID_KEYBOARD, kb_status);
+    payload_flow_id = ++hid_payload_taken_count;
+    send_hid_payload(&payload, payload_flow_id);
   }
 }
 
 // Invoked when sent REPORT successfully to host
 // Application can use this to send the next report
-// Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len)
 {
-  (void) instance;
+  (void) report;
   (void) len;
 
-  uint8_t next_report_id = report[0] + 1u;
-
-  // if (next_report_id < REPORT_ID_COUNT)
-  // {
-  //   kb_pressed_keycodes_t kb_status;
-  //   uint32_t owner_out;
-  //   if (mutex_try_enter(&my_mutex,&owner_out)){
-  //     kb_status = core1_kb_status;
-  //     mutex_exit(&my_mutex);
-  //   }
-  //   send_hid_report(next_report_id, kb_status);
-  // }
+  if (instance < ITF_NUM_TOTAL)
+  {
+    uint32_t const now_us = time_us_32();
+    kb_period_add(&hid_poll_stats[instance], now_us - hid_report_sent_us[instance]);
+    kb_trace_slice(KB_TRACE_POLL, now_us, now_us, hid_report_flow_id[instance]);
+  }
+}
+
+// Feature channel: blobs are read in pages.
+// SET_REPORT(Feature) [page] selects a page, every GET_REPORT(Feature) returns
+// [page] [number of pages] [FEATURE_PAGE_DATA_LEN bytes of the blob] and moves on to the next page of the blob.
+// Pages from 0 hold the kb_heatmap_blob_t, pages from FEATURE_PAGE_SPLIT_STATS the kb_split_stats_t
+// of a split primary (the only output of a split build, its UART carries the link)
+#define FEATURE_PAGE_DATA_LEN (USB_HID_FEATURE_REPORT_SIZE - 2)
+#define FEATURE_NUM_OF_PAGES(blob_size) (((blob_size) + FEATURE_PAGE_DATA_LEN - 1) / FEATURE_PAGE_DATA_LEN)
+#define FEATURE_PAGE_SPLIT_STATS 0x80
+
+TU_VERIFY_STATIC(FEATURE_NUM_OF_PAGES(sizeof(kb_heatmap_blob_t)) <= FEATURE_PAGE_SPLIT_STATS, "Heatmap pages run into the split stats pages");
+
+static uint8_t feature_page = 0;
+
+// First page and number of pages of the blob a page belongs to, false if it belongs to none
+static bool feature_blob_pages(uint8_t page, uint8_t* first_page, uint8_t* num_of_pages)
+{
+  if (page < FEATURE_NUM_OF_PAGES(sizeof(kb_heatmap_blob_t)))
+  {
+    *first_page = 0;
+    *num_of_pages = FEATURE_NUM_OF_PAGES(sizeof(kb_heatmap_blob_t));
+    return true;
+  }
+#if KB_SPLIT_ENABLED
+  if ((page >= FEATURE_PAGE_SPLIT_STATS) && (page < FEATURE_PAGE_SPLIT_STATS + FEATURE_NUM_OF_PAGES(sizeof(kb_split_stats_t))))
+  {
+    *first_page = FEATURE_PAGE_SPLIT_STATS;
+    *num_of_pages = FEATURE_NUM_OF_PAGES(sizeof(kb_split_stats_t));
+    return true;
+  }
+#endif
+  return false;
 }
 
 // Invoked when received GET_REPORT control request
@@ -261,12 +567,34 @@ void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_
 // Return zero will cause the stack to STALL request
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
 {
-  // TODO not Implemented
-  (void) instance;
   (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) reqlen;
+
+  // Heatmap and split link export, see FEATURE_PAGE_DATA_LEN
+  if ((instance == ITF_NUM_FEATURE) && (report_type == HID_REPORT_TYPE_FEATURE))
+  {
+    uint8_t first_page, num_of_pages;
+    if (reqlen < USB_HID_FEATURE_REPORT_SIZE) return 0;
+    if (!feature_blob_pages(feature_page, &first_page, &num_of_pages)) return 0;
+
+    uint32_t const offset = (uint32_t) (feature_page - first_page) * FEATURE_PAGE_DATA_LEN;
+    buffer[0] = feature_page;
+    buffer[1] = num_of_pages;
+#if KB_SPLIT_ENABLED
+    if (first_page == FEATURE_PAGE_SPLIT_STATS)
+    {
+      // Updated from the RX interrupt on core1, a read may mix two pings like the heatmap does scans
+      kb_split_stats_t const stats = kb_split_get_stats();
+      memset(&buffer[2], 0, FEATURE_PAGE_DATA_LEN);
+      memcpy(&buffer[2], ((uint8_t const*) &stats) + offset, tu_min32(FEATURE_PAGE_DATA_LEN, sizeof(stats) - offset));
+    }else
+#endif
+    {
+      kb_heatmap_read(offset, &buffer[2], FEATURE_PAGE_DATA_LEN);
+    }
+    feature_page = (uint8_t) (first_page + (feature_page - first_page + 1) % num_of_pages);
+
+    return USB_HID_FEATURE_REPORT_SIZE;
+  }
 
   return 0;
 }
@@ -275,12 +603,21 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
-  (void) instance;
+  (void) report_id;
+
+  // Select the page returned by the next GET_REPORT
+  if ((instance == ITF_NUM_FEATURE) && (report_type == HID_REPORT_TYPE_FEATURE))
+  {
+    uint8_t first_page, num_of_pages;
+    if ((bufsize >= 1) && feature_blob_pages(buffer[0], &first_page, &num_of_pages)) feature_page = buffer[0];
+    return;
+  }
 
   if (report_type == HID_REPORT_TYPE_OUTPUT)
   {
     // Set keyboard LED e.g Capslock, Numlock etc...
-    if (report_id == REPORT_ID_KEYBOARD)
+    // Host may send LED state to either keyboard interface
+    if ((instance == ITF_NUM_KEYBOARD) || (instance == ITF_NUM_NKRO))
     {
       // bufsize should be (at least) 1
       if ( bufsize < 1 ) return;
@@ -31,11 +31,15 @@
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
  *
  * Auto ProductID layout's Bitmap:
- *   [MSB]         HID | MSC | CDC          [LSB]
+ *   [MSB]   HID count - 1 | VENDOR | MIDI | HID | MSC | CDC          [LSB]
+ *
+ * Class bits are 0/1 flags, so several HID interfaces do not spill into the MIDI/VENDOR bits.
+ * The number of HID interfaces gets its own field, a different HID layout is a different PID.
  */
-#define _PID_MAP(itf, n)  ( (CFG_TUD_##itf) << (n) )
+#define _PID_MAP(itf, n)  ( ((CFG_TUD_##itf) ? 1 : 0) << (n) )
+#define _PID_HID_COUNT    ( ((CFG_TUD_HID) ? (CFG_TUD_HID) - 1 : 0) << 5 )
 #define USB_PID           (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) | _PID_MAP(HID, 2) | \
-                           _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) )
+                           _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) | _PID_HID_COUNT )
 
 #define USB_VID   0xCafe
 #define USB_BCD   0x0200
@@ -75,12 +79,30 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] =
+// Boot keyboard: must match the boot protocol layout, so no report ID
+uint8_t const desc_hid_keyboard_report[] =
+{
+  TUD_HID_REPORT_DESC_KEYBOARD()
+};
+
+uint8_t const desc_hid_nkro_report[] =
+{
+  MY_TUD_HID_REPORT_DESC_NKRO()
+};
+
+uint8_t const desc_hid_consumer_report[] =
+{
+  MY_TUD_HID_REPORT_DESC_CONSUMER()
+};
+
+uint8_t const desc_hid_feature_report[] =
 {
-  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         )),
-//  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
-  MY_TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL ))//,
-//  TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD          ))
+  MY_TUD_HID_REPORT_DESC_FEATURE()
+};
+
+uint8_t const desc_hid_mouse_report[] =
+{
+  TUD_HID_REPORT_DESC_MOUSE()
 };
 
 // Invoked when received GET HID REPORT DESCRIPTOR
@@ -88,23 +110,36 @@ uint8_t const desc_hid_report[] =
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
-  (void) instance;
-  return desc_hid_report;
+  switch (instance)
+  {
+    case ITF_NUM_KEYBOARD: return desc_hid_keyboard_report;
+    case ITF_NUM_NKRO:     return desc_hid_nkro_report;
+    case ITF_NUM_CONSUMER: return desc_hid_consumer_report;
+    case ITF_NUM_FEATURE:  return desc_hid_feature_report;
+    case ITF_NUM_MOUSE:    return desc_hid_mouse_report;
+    default:               return NULL;
+  }
 }
 
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
-enum
-{
-  ITF_NUM_HID,
-  ITF_NUM_TOTAL
-};
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + ITF_NUM_TOTAL * TUD_HID_DESC_LEN)
 
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+// One IN endpoint per interface, so media reports never queue behind keyboard reports
+#define EPNUM_HID_KEYBOARD   0x81
+#define EPNUM_HID_NKRO       0x82
+#define EPNUM_HID_CONSUMER   0x83
+#define EPNUM_HID_FEATURE    0x84
+#define EPNUM_HID_MOUSE      0x85
 
-#define EPNUM_HID   0x81
+#define EPSIZE_HID_KEYBOARD  8
+#define EPSIZE_HID_NKRO      CFG_TUD_HID_EP_BUFSIZE
+#define EPSIZE_HID_CONSUMER  8
+// The feature channel has no input report, HID still requires an interrupt IN endpoint
+#define EPSIZE_HID_FEATURE   8
+#define EPSIZE_HID_MOUSE     8
 
 uint8_t const desc_configuration[] =
 {
@@ -112,9 +147,34 @@ uint8_t const desc_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
+  TUD_HID_DESCRIPTOR(ITF_NUM_KEYBOARD, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_keyboard_report), EPNUM_HID_KEYBOARD, EPSIZE_HID_KEYBOARD, 1),
+  TUD_HID_DESCRIPTOR(ITF_NUM_NKRO, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_nkro_report), EPNUM_HID_NKRO, EPSIZE_HID_NKRO, 1),
+  TUD_HID_DESCRIPTOR(ITF_NUM_CONSUMER, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_consumer_report), EPNUM_HID_CONSUMER, EPSIZE_HID_CONSUMER, 10),
+  TUD_HID_DESCRIPTOR(ITF_NUM_FEATURE, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_feature_report), EPNUM_HID_FEATURE, EPSIZE_HID_FEATURE, 100),
+  // Polled every frame, mouse keys move the pointer in 1 ms steps
+  TUD_HID_DESCRIPTOR(ITF_NUM_MOUSE, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_mouse_report), EPNUM_HID_MOUSE, EPSIZE_HID_MOUSE, 1)
 };
 
+//--------------------------------------------------------------------+
+// Descriptor self-test, checked on every build
+//--------------------------------------------------------------------+
+
+TU_VERIFY_STATIC(ITF_NUM_TOTAL == CFG_TUD_HID, "Every HID interface needs a TinyUSB HID instance");
+TU_VERIFY_STATIC(sizeof(desc_configuration) == CONFIG_TOTAL_LEN, "CONFIG_TOTAL_LEN does not match the configuration descriptor");
+TU_VERIFY_STATIC(sizeof(hid_keyboard_report_t) <= EPSIZE_HID_KEYBOARD, "Boot keyboard report does not fit its endpoint");
+TU_VERIFY_STATIC(sizeof(hid_nkro_report_t) <= EPSIZE_HID_NKRO, "NKRO report does not fit its endpoint");
+TU_VERIFY_STATIC(EPSIZE_HID_NKRO <= CFG_TUD_HID_EP_BUFSIZE, "CFG_TUD_HID_EP_BUFSIZE is smaller than the NKRO endpoint");
+TU_VERIFY_STATIC(EPSIZE_HID_CONSUMER <= CFG_TUD_HID_EP_BUFSIZE, "CFG_TUD_HID_EP_BUFSIZE is smaller than the consumer endpoint");
+TU_VERIFY_STATIC(sizeof(hid_mouse_report_t) <= EPSIZE_HID_MOUSE, "Mouse report does not fit its endpoint");
+TU_VERIFY_STATIC(USB_HID_FEATURE_REPORT_SIZE <= CFG_TUD_HID_EP_BUFSIZE, "GET_REPORT is limited to CFG_TUD_HID_EP_BUFSIZE");
+// Endpoint N+1 belongs to interface N, so no two interfaces share an endpoint
+TU_VERIFY_STATIC((EPNUM_HID_KEYBOARD == (0x81 + ITF_NUM_KEYBOARD)) && (EPNUM_HID_NKRO == (0x81 + ITF_NUM_NKRO)) &&
+                 (EPNUM_HID_CONSUMER == (0x81 + ITF_NUM_CONSUMER)) && (EPNUM_HID_FEATURE == (0x81 + ITF_NUM_FEATURE)) &&
+                 (EPNUM_HID_MOUSE == (0x81 + ITF_NUM_MOUSE)),
+                 "HID interfaces must not share an endpoint");
+TU_VERIFY_STATIC((USB_PID & 0x0004) && ((USB_PID >> 5) & 0x07) == CFG_TUD_HID - 1,
+                 "Auto PID does not encode the HID layout");
+
 #if TUD_OPT_HIGH_SPEED
 // Per USB specs: high speed capable device must report device_qualifier and other_speed_configuration
 
@@ -0,0 +1,68 @@
+#ifndef FW_HARNESS__H
+#define FW_HARNESS__H
+
+#include <string.h>
+
+#include "mock_dcd.h"
+
+//--------------------------------------------------------------------+
+// Both cores of the firmware on one thread, included after main.c
+//--------------------------------------------------------------------+
+
+// A step is one pass of the core1 loop, whose matrix scan waits on the timer for every column and
+// so moves virtual time (about 150 us), then the host frames that started meanwhile, then one pass
+// of core0's loop. The keys are wired to the scanned GPIOs: a test says which contacts are closed.
+
+extern const uint kb_columns[KB_NUM_OF_COLS];
+extern const uint kb_rows[KB_NUM_OF_ROWS];
+
+// Fills the contacts closed at now_us, asked at every column read of a scan
+typedef void (*fw_keys_cb_t)(kb_matrix_t* keys, uint32_t now_us);
+static fw_keys_cb_t fw_keys_cb = NULL;
+
+static inline uint32_t fw_gpio_in(uint32_t gpio_out){
+  kb_matrix_t keys;
+  memset(&keys, 0, sizeof(keys));
+  if(fw_keys_cb) fw_keys_cb(&keys, time_us_32());
+
+  uint32_t gpio_in = 0;
+  for(uint col_idx = 0; col_idx < KB_NUM_OF_COLS; col_idx++){
+    if(!(gpio_out & (1u << kb_columns[col_idx]))) continue;
+    for(uint row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+      if(keys.rows[row_idx] & (1u << col_idx)) gpio_in |= 1u << kb_rows[row_idx];
+    }
+  }
+  return gpio_in;
+}
+
+// As main() and core1_entry() up to their loops
+static inline void fw_init(void){
+  host_gpio_in = fw_gpio_in;
+  kb_period_reset(&core0_loop_stats);
+  kb_period_reset(&core1_scan_stats);
+  kb_period_reset(&mouse_report_stats);
+  for(uint i = 0; i < ITF_NUM_TOTAL; i++) kb_period_reset(&hid_poll_stats[i]);
+  kb_payload_queue_init(&hid_payload_queue);
+  tud_init(BOARD_TUD_RHPORT);
+
+  core1_now_ms = to_ms_since_boot(get_absolute_time());
+  core1_ms_tick_us = time_us_32();
+}
+
+static inline void fw_core0_task(void){
+  tud_task();
+  hid_task();
+}
+
+static inline void fw_step(void){
+  core1_scan_task();
+  mock_host_catch_up();
+  fw_core0_task();
+}
+
+static inline void fw_run_us(uint32_t duration_us){
+  uint64_t const end_us = host_time_us + duration_us;
+  while(host_time_us < end_us) fw_step();
+}
+
+#endif //FW_HARNESS__H
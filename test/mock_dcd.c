@@ -0,0 +1,347 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "device/dcd.h"
+#include "mock_dcd.h"
+
+#define MOCK_NUM_OF_EPS 16
+// Bound on the tud_task() runs of one host action, a device that never answers fails instead of hanging
+#define MOCK_MAX_TASK_RUNS 64
+
+static mock_host_ep_t mock_eps[MOCK_NUM_OF_EPS][2];
+static bool sof_enabled = false;
+static bool suspended = false;
+static bool remote_wakeup_signalled = false;
+static uint32_t frame_number = 0;
+// Start of the last frame, frames start every 1000 us whether the bus is suspended or not
+static uint64_t frame_start_us = 0;
+static mock_host_report_cb_t report_cb = NULL;
+
+// Control transfer in progress
+static struct
+{
+  tusb_control_request_t request;
+  uint8_t* data;
+  uint16_t data_len;        /**< Bytes moved by the data stage so far. */
+  bool done;                /**< Status stage reached. */
+  bool stalled;
+} ctrl;
+
+static uint8_t config_desc[MOCK_HOST_MAX_DESC_LEN];
+static uint16_t config_desc_len = 0;
+static uint8_t report_desc[MOCK_HOST_MAX_HID_ITFS][MOCK_HOST_MAX_DESC_LEN];
+static uint16_t report_desc_len[MOCK_HOST_MAX_HID_ITFS];
+
+static mock_host_ep_t* ep_of(uint8_t ep_addr){
+  return &mock_eps[tu_edpt_number(ep_addr)][tu_edpt_dir(ep_addr)];
+}
+
+static void run_device_stack(void){
+  for(int run = 0; (run < MOCK_MAX_TASK_RUNS) && tud_task_event_ready(); run++){
+    tud_task();
+  }
+}
+
+//--------------------------------------------------------------------+
+// Control endpoint: every stage completes as soon as the device queues it
+//--------------------------------------------------------------------+
+
+static void control_xfer(uint8_t ep_addr, uint8_t* buffer, uint16_t total_bytes){
+  uint16_t len = 0;
+
+  if(tu_edpt_dir(ep_addr) != ctrl.request.bmRequestType_bit.direction){
+    // Status stage: the direction opposite to the data, IN if there was no data
+    ctrl.done = true;
+  }else{
+    len = tu_min16(total_bytes, (uint16_t) (ctrl.request.wLength - ctrl.data_len));
+    if(tu_edpt_dir(ep_addr) == TUSB_DIR_IN){
+      memcpy(ctrl.data + ctrl.data_len, buffer, len);
+    }else{
+      memcpy(buffer, ctrl.data + ctrl.data_len, len);
+    }
+    ctrl.data_len = (uint16_t) (ctrl.data_len + len);
+  }
+
+  dcd_event_xfer_complete(0, ep_addr, len, XFER_RESULT_SUCCESS, false);
+}
+
+//--------------------------------------------------------------------+
+// DCD port API, called by the TinyUSB device stack
+//--------------------------------------------------------------------+
+
+// TinyUSB 0.17 passes the init options to the port and expects a result
+#if (TUSB_VERSION_MAJOR == 0) && (TUSB_VERSION_MINOR < 17)
+void dcd_init(uint8_t rhport){
+  (void) rhport;
+  memset(mock_eps, 0, sizeof(mock_eps));
+}
+#else
+bool dcd_init(uint8_t rhport, tusb_rhport_init_t const* rh_init){
+  (void) rhport;
+  (void) rh_init;
+  memset(mock_eps, 0, sizeof(mock_eps));
+  return true;
+}
+#endif
+
+void dcd_int_handler(uint8_t rhport){
+  (void) rhport;
+}
+
+// Events are queued from the test thread, there is no interrupt to mask
+void dcd_int_enable(uint8_t rhport){
+  (void) rhport;
+}
+
+void dcd_int_disable(uint8_t rhport){
+  (void) rhport;
+}
+
+// The port sends the status stage of SET_ADDRESS itself
+void dcd_set_address(uint8_t rhport, uint8_t dev_addr){
+  (void) dev_addr;
+  dcd_edpt_xfer(rhport, tu_edpt_addr(0, TUSB_DIR_IN), NULL, 0);
+}
+
+void dcd_remote_wakeup(uint8_t rhport){
+  (void) rhport;
+  remote_wakeup_signalled = true;
+}
+
+void dcd_connect(uint8_t rhport){
+  (void) rhport;
+}
+
+void dcd_disconnect(uint8_t rhport){
+  (void) rhport;
+}
+
+void dcd_sof_enable(uint8_t rhport, bool en){
+  (void) rhport;
+  sof_enabled = en;
+}
+
+bool dcd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const* desc_ep){
+  (void) rhport;
+  mock_host_ep_t* ep = ep_of(desc_ep->bEndpointAddress);
+  memset(ep, 0, sizeof(*ep));
+  ep->opened = true;
+  ep->interval = desc_ep->bInterval ? desc_ep->bInterval : 1;
+  ep->max_packet_size = tu_edpt_packet_size(desc_ep);
+  return true;
+}
+
+void dcd_edpt_close(uint8_t rhport, uint8_t ep_addr){
+  (void) rhport;
+  memset(ep_of(ep_addr), 0, sizeof(mock_host_ep_t));
+}
+
+void dcd_edpt_close_all(uint8_t rhport){
+  (void) rhport;
+  memset(&mock_eps[1], 0, sizeof(mock_eps) - sizeof(mock_eps[0]));
+}
+
+bool dcd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t* buffer, uint16_t total_bytes){
+  (void) rhport;
+  if(tu_edpt_number(ep_addr) == 0){
+    control_xfer(ep_addr, buffer, total_bytes);
+    return true;
+  }
+
+  mock_host_ep_t* ep = ep_of(ep_addr);
+  if(!ep->opened) return false;
+  ep->buffer = buffer;
+  ep->len = total_bytes;
+  ep->armed = true;
+  ep->armed_us = time_us_32();
+  return true;
+}
+
+// No isochronous endpoint in this device, usbd.c still links against both
+bool dcd_edpt_iso_alloc(uint8_t rhport, uint8_t ep_addr, uint16_t largest_packet_size){
+  (void) rhport;
+  (void) ep_addr;
+  (void) largest_packet_size;
+  return false;
+}
+
+bool dcd_edpt_iso_activate(uint8_t rhport, tusb_desc_endpoint_t const* desc_ep){
+  (void) rhport;
+  (void) desc_ep;
+  return false;
+}
+
+void dcd_edpt_stall(uint8_t rhport, uint8_t ep_addr){
+  (void) rhport;
+  if(tu_edpt_number(ep_addr) == 0) ctrl.stalled = true;
+}
+
+void dcd_edpt_clear_stall(uint8_t rhport, uint8_t ep_addr){
+  (void) rhport;
+  (void) ep_addr;
+}
+
+//--------------------------------------------------------------------+
+// Host
+//--------------------------------------------------------------------+
+
+void mock_host_bus_reset(void){
+  dcd_edpt_close_all(0);
+  suspended = false;
+  dcd_event_bus_reset(0, TUSB_SPEED_FULL, false);
+  run_device_stack();
+}
+
+bool mock_host_control(uint8_t bm_request_type, uint8_t b_request, uint16_t w_value, uint16_t w_index,
+                       uint16_t w_length, void* data){
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.request.bmRequestType = bm_request_type;
+  ctrl.request.bRequest = b_request;
+  ctrl.request.wValue = tu_htole16(w_value);
+  ctrl.request.wIndex = tu_htole16(w_index);
+  ctrl.request.wLength = tu_htole16(w_length);
+  ctrl.data = (uint8_t*) data;
+
+  dcd_event_setup_received(0, (uint8_t const*) &ctrl.request, false);
+  run_device_stack();
+  return ctrl.done && !ctrl.stalled;
+}
+
+uint16_t mock_host_control_len(void){
+  return ctrl.data_len;
+}
+
+static bool get_descriptor(uint8_t type, uint8_t index, uint16_t langid, uint16_t len, void* data){
+  return mock_host_control(0x80, TUSB_REQ_GET_DESCRIPTOR, (uint16_t) ((type << 8) | index), langid, len, data);
+}
+
+bool mock_host_enumerate(void){
+  uint8_t buf[MOCK_HOST_MAX_DESC_LEN];
+
+  // At address 0, the first read only needs bMaxPacketSize0
+  mock_host_bus_reset();
+  if(!get_descriptor(TUSB_DESC_DEVICE, 0, 0, 64, buf)) return false;
+  mock_host_bus_reset();
+  if(!mock_host_control(0x00, TUSB_REQ_SET_ADDRESS, 1, 0, 0, NULL)) return false;
+
+  tusb_desc_device_t device_desc;
+  if(!get_descriptor(TUSB_DESC_DEVICE, 0, 0, sizeof(device_desc), &device_desc)) return false;
+
+  // Configuration header first, then all of it
+  if(!get_descriptor(TUSB_DESC_CONFIGURATION, 0, 0, 9, config_desc)) return false;
+  uint16_t const total_len = (uint16_t) (config_desc[2] | (config_desc[3] << 8));
+  if(total_len > sizeof(config_desc)) return false;
+  if(!get_descriptor(TUSB_DESC_CONFIGURATION, 0, 0, total_len, config_desc)) return false;
+  config_desc_len = mock_host_control_len();
+
+  // Language IDs, then the strings of the device descriptor
+  if(!get_descriptor(TUSB_DESC_STRING, 0, 0, 255, buf)) return false;
+  uint8_t const string_idx[] = { device_desc.iManufacturer, device_desc.iProduct, device_desc.iSerialNumber };
+  for(uint i = 0; i < TU_ARRAY_SIZE(string_idx); i++){
+    if(string_idx[i] && !get_descriptor(TUSB_DESC_STRING, string_idx[i], 0x0409, 255, buf)) return false;
+  }
+
+  if(!mock_host_control(0x00, TUSB_REQ_SET_CONFIGURATION, 1, 0, 0, NULL)) return false;
+
+  // HID: idle rate 0 and the report descriptor of every interface, as a HID driver does
+  memset(report_desc_len, 0, sizeof(report_desc_len));
+  uint8_t itf = 0;
+  for(uint16_t offset = 0; offset + 1 < config_desc_len; offset = (uint16_t) (offset + config_desc[offset])){
+    uint8_t const* desc = &config_desc[offset];
+    if(desc[0] == 0) return false;
+
+    if(desc[1] == TUSB_DESC_INTERFACE){
+      itf = desc[2];
+    }else if((desc[1] == HID_DESC_TYPE_HID) && (itf < MOCK_HOST_MAX_HID_ITFS)){
+      uint16_t const len = (uint16_t) (desc[7] | (desc[8] << 8));
+      if(len > MOCK_HOST_MAX_DESC_LEN) return false;
+      if(!mock_host_control(0x21, HID_REQ_CONTROL_SET_IDLE, 0, itf, 0, NULL)) return false;
+      if(!mock_host_control(0x81, TUSB_REQ_GET_DESCRIPTOR, HID_DESC_TYPE_REPORT << 8, itf, len, report_desc[itf])) return false;
+      report_desc_len[itf] = mock_host_control_len();
+    }
+  }
+  return true;
+}
+
+uint8_t const* mock_host_config_desc(uint16_t* len){
+  *len = config_desc_len;
+  return config_desc;
+}
+
+uint8_t const* mock_host_report_desc(uint8_t itf, uint16_t* len){
+  *len = (itf < MOCK_HOST_MAX_HID_ITFS) ? report_desc_len[itf] : 0;
+  return (itf < MOCK_HOST_MAX_HID_ITFS) ? report_desc[itf] : NULL;
+}
+
+static void poll_ep(uint8_t ep_addr){
+  mock_host_ep_t* ep = ep_of(ep_addr);
+  uint16_t const len = tu_min16(ep->len, MOCK_HOST_MAX_REPORT_LEN);
+
+  memcpy(ep->report, ep->buffer, len);
+  ep->report_len = len;
+  ep->num_of_reports++;
+  ep->latency_us = time_us_32() - ep->armed_us;
+  if(ep->latency_us > ep->latency_max_us) ep->latency_max_us = ep->latency_us;
+  ep->armed = false;
+
+  dcd_event_xfer_complete(0, ep_addr, ep->len, XFER_RESULT_SUCCESS, false);
+  if(report_cb) report_cb(ep_addr, ep->report, len);
+}
+
+static void run_frame(void){
+  if(suspended) return;
+
+  frame_number++;
+  if(sof_enabled) dcd_event_bus_signal(0, DCD_EVENT_SOF, false);
+
+  for(uint8_t num = 1; num < MOCK_NUM_OF_EPS; num++){
+    mock_host_ep_t const* ep = &mock_eps[num][TUSB_DIR_IN];
+    if(ep->opened && ep->armed && (frame_number % ep->interval == 0)){
+      poll_ep(tu_edpt_addr(num, TUSB_DIR_IN));
+    }
+  }
+}
+
+void mock_host_catch_up(void){
+  while(host_time_us >= frame_start_us + 1000){
+    frame_start_us += 1000;
+    run_frame();
+  }
+}
+
+void mock_host_frame(void){
+  if(host_time_us < frame_start_us + 1000) host_time_advance_us(frame_start_us + 1000 - host_time_us);
+  mock_host_catch_up();
+}
+
+void mock_host_on_report(mock_host_report_cb_t cb){
+  report_cb = cb;
+}
+
+uint32_t mock_host_frame_number(void){
+  return frame_number;
+}
+
+void mock_host_set_poll_interval(uint8_t ep_addr, uint8_t interval){
+  ep_of(ep_addr)->interval = interval ? interval : 1;
+}
+
+mock_host_ep_t const* mock_host_ep(uint8_t ep_addr){
+  return ep_of(ep_addr);
+}
+
+void mock_host_suspend(void){
+  suspended = true;
+  dcd_event_bus_signal(0, DCD_EVENT_SUSPEND, false);
+  run_device_stack();
+}
+
+void mock_host_resume(void){
+  suspended = false;
+  remote_wakeup_signalled = false;
+  dcd_event_bus_signal(0, DCD_EVENT_RESUME, false);
+}
+
+bool mock_host_remote_wakeup_signalled(void){
+  return remote_wakeup_signalled;
+}
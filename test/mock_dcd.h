@@ -0,0 +1,75 @@
+#ifndef MOCK_DCD__H
+#define MOCK_DCD__H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "tusb.h"
+
+//--------------------------------------------------------------------+
+// Stand-in USB device controller and the host on the other end of the bus
+//--------------------------------------------------------------------+
+
+// TinyUSB's device stack runs unchanged on top of it (the dcd_* port API). The host side is driven
+// by the test: control transfers complete within the tud_task() calls they start, and IN endpoints
+// are polled on a virtual 1 ms frame clock, every bInterval frames, with host_time_us moved to each
+// frame start so report to poll latencies are exact.
+
+#define MOCK_HOST_MAX_REPORT_LEN 64
+#define MOCK_HOST_MAX_DESC_LEN 512
+#define MOCK_HOST_MAX_HID_ITFS 8
+
+typedef struct
+{
+  bool opened;
+  uint8_t interval;         /**< Frames between polls, bInterval unless the test overrides it. */
+  uint16_t max_packet_size;
+
+  // Transfer queued by the device, taken by the next poll
+  uint8_t* buffer;
+  uint16_t len;
+  bool armed;
+  uint32_t armed_us;
+
+  // What the host received
+  uint32_t num_of_reports;
+  uint8_t report[MOCK_HOST_MAX_REPORT_LEN];
+  uint16_t report_len;
+  uint32_t latency_us;      /**< Last time from the transfer being queued to the poll that took it. */
+  uint32_t latency_max_us;
+} mock_host_ep_t;
+
+// Bus reset, the device is then at address 0 and unconfigured
+void mock_host_bus_reset(void);
+// Runs a control transfer to completion: setup, data stage (data is read for OUT and written for IN
+// requests, up to wLength) and status. Returns false if the device stalled it
+bool mock_host_control(uint8_t bm_request_type, uint8_t b_request, uint16_t w_value, uint16_t w_index,
+                       uint16_t w_length, void* data);
+// Bytes received by the data stage of the last IN control transfer
+uint16_t mock_host_control_len(void);
+// Resets the bus and enumerates like a host OS: device descriptor, address, configuration
+// descriptor, strings, SET_CONFIGURATION and the HID report descriptors. Returns false on any stall
+bool mock_host_enumerate(void);
+// Configuration descriptor and HID report descriptors read by mock_host_enumerate()
+uint8_t const* mock_host_config_desc(uint16_t* len);
+uint8_t const* mock_host_report_desc(uint8_t itf, uint16_t* len);
+
+// One frame: time moves to the next frame start, SOF is signalled if the device asked for it,
+// then every due IN endpoint with a queued transfer is polled. Nothing is polled while suspended
+void mock_host_frame(void);
+// Runs the frames that started since the last one, for tests in which the device moves time
+// itself (a matrix scan waits on the timer). Time is left as it is
+void mock_host_catch_up(void);
+// Called for every report the host takes, after the endpoint's fields are updated
+typedef void (*mock_host_report_cb_t)(uint8_t ep_addr, uint8_t const* report, uint16_t len);
+void mock_host_on_report(mock_host_report_cb_t cb);
+uint32_t mock_host_frame_number(void);
+void mock_host_set_poll_interval(uint8_t ep_addr, uint8_t interval);
+mock_host_ep_t const* mock_host_ep(uint8_t ep_addr);
+
+void mock_host_suspend(void);
+void mock_host_resume(void);
+// Set once the device signals remote wakeup, cleared by mock_host_resume()
+bool mock_host_remote_wakeup_signalled(void);
+
+#endif //MOCK_DCD__H
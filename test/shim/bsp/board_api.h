@@ -0,0 +1,30 @@
+#ifndef HOST_SHIM_BSP_BOARD_API__H
+#define HOST_SHIM_BSP_BOARD_API__H
+
+#include <stddef.h>
+#include "pico/stdlib.h"
+
+//--------------------------------------------------------------------+
+// Host stand-in for the TinyUSB board support
+//--------------------------------------------------------------------+
+
+// State of the board LED, for the tests to read
+extern bool host_led;
+
+static inline void board_init(void){
+}
+
+void board_init_after_tusb(void) __attribute__((weak));
+
+static inline uint32_t board_millis(void){
+  return (uint32_t) (host_time_us / 1000);
+}
+
+static inline void board_led_write(bool state){
+  host_led = state;
+}
+
+// Fixed serial number, "0123456789ABCDEF"
+size_t board_usb_get_serial(uint16_t desc_str1[], size_t max_chars);
+
+#endif //HOST_SHIM_BSP_BOARD_API__H
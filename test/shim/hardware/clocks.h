@@ -0,0 +1,20 @@
+#ifndef HOST_SHIM_HARDWARE_CLOCKS__H
+#define HOST_SHIM_HARDWARE_CLOCKS__H
+
+#include "pico/stdlib.h"
+
+#define MHZ 1000000u
+
+enum clock_index
+{
+  clk_gpout0 = 0, clk_gpout1, clk_gpout2, clk_gpout3, clk_ref, clk_sys, clk_peri, clk_usb, clk_adc, clk_rtc,
+  CLK_COUNT
+};
+
+// Default clk_sys of the Pico SDK
+static inline uint32_t clock_get_hz(enum clock_index clk_index){
+  (void) clk_index;
+  return 125 * MHZ;
+}
+
+#endif //HOST_SHIM_HARDWARE_CLOCKS__H
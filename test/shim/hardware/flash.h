@@ -0,0 +1,20 @@
+#ifndef HOST_SHIM_HARDWARE_FLASH__H
+#define HOST_SHIM_HARDWARE_FLASH__H
+
+#include "pico/stdlib.h"
+
+//--------------------------------------------------------------------+
+// Flash: a small array in host memory, blank (no saved record) at start
+//--------------------------------------------------------------------+
+
+#define FLASH_PAGE_SIZE 256u
+#define FLASH_SECTOR_SIZE 4096u
+#define PICO_FLASH_SIZE_BYTES (4u * FLASH_SECTOR_SIZE)
+
+extern uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t) host_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, uint8_t const* data, size_t count);
+
+#endif //HOST_SHIM_HARDWARE_FLASH__H
@@ -0,0 +1,17 @@
+#ifndef HOST_SHIM_HARDWARE_STRUCTS_SYSTICK__H
+#define HOST_SHIM_HARDWARE_STRUCTS_SYSTICK__H
+
+#include <stdint.h>
+
+// Cycle counts read 0 on the host, the cycle statistics are not tested
+typedef struct
+{
+  volatile uint32_t csr;
+  volatile uint32_t rvr;
+  volatile uint32_t cvr;
+  volatile uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t* systick_hw;
+
+#endif //HOST_SHIM_HARDWARE_STRUCTS_SYSTICK__H
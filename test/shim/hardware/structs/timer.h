@@ -0,0 +1,15 @@
+#ifndef HOST_SHIM_HARDWARE_STRUCTS_TIMER__H
+#define HOST_SHIM_HARDWARE_STRUCTS_TIMER__H
+
+#include "pico/stdlib.h"
+
+// Raw timer registers follow host_time_us
+typedef struct
+{
+  volatile uint32_t timerawh;
+  volatile uint32_t timerawl;
+} timer_hw_t;
+
+extern timer_hw_t* timer_hw;
+
+#endif //HOST_SHIM_HARDWARE_STRUCTS_TIMER__H
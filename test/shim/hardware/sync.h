@@ -0,0 +1,17 @@
+#ifndef HOST_SHIM_HARDWARE_SYNC__H
+#define HOST_SHIM_HARDWARE_SYNC__H
+
+#include "pico/stdlib.h"
+
+// Tests run on one thread, "interrupts" are the bytes a test feeds in between calls
+static inline uint32_t save_and_disable_interrupts(void){
+  return 0;
+}
+
+static inline void restore_interrupts(uint32_t status){
+  (void) status;
+}
+
+#define __dmb() __sync_synchronize()
+
+#endif //HOST_SHIM_HARDWARE_SYNC__H
@@ -0,0 +1,12 @@
+#ifndef HOST_SHIM_HARDWARE_VREG__H
+#define HOST_SHIM_HARDWARE_VREG__H
+
+enum vreg_voltage
+{
+  VREG_VOLTAGE_0_85 = 0b0110, VREG_VOLTAGE_0_90, VREG_VOLTAGE_0_95, VREG_VOLTAGE_1_00,
+  VREG_VOLTAGE_1_05, VREG_VOLTAGE_1_10, VREG_VOLTAGE_1_15, VREG_VOLTAGE_1_20,
+  VREG_VOLTAGE_1_25, VREG_VOLTAGE_1_30,
+  VREG_VOLTAGE_DEFAULT = VREG_VOLTAGE_1_10,
+};
+
+#endif //HOST_SHIM_HARDWARE_VREG__H
@@ -0,0 +1,45 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/structs/timer.h"
+#include "hardware/structs/systick.h"
+#include "hardware/flash.h"
+#include "bsp/board_api.h"
+
+uint64_t host_time_us = 0;
+
+static timer_hw_t host_timer;
+timer_hw_t* timer_hw = &host_timer;
+
+static systick_hw_t host_systick;
+systick_hw_t* systick_hw = &host_systick;
+
+bool host_led = false;
+
+uint32_t host_gpio_out = 0;
+uint32_t (*host_gpio_in)(uint32_t gpio_out) = NULL;
+
+uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+
+void host_time_advance_us(uint64_t delay_us){
+  host_time_us += delay_us;
+  host_timer.timerawh = (uint32_t) (host_time_us >> 32);
+  host_timer.timerawl = (uint32_t) host_time_us;
+}
+
+size_t board_usb_get_serial(uint16_t desc_str1[], size_t max_chars){
+  static char const serial[] = "0123456789ABCDEF";
+  size_t len = sizeof(serial) - 1;
+  if(len > max_chars) len = max_chars;
+  for(size_t i = 0; i < len; i++){
+    desc_str1[i] = (uint16_t) serial[i];
+  }
+  return len;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count){
+  memset(&host_flash[flash_offs], 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, uint8_t const* data, size_t count){
+  memcpy(&host_flash[flash_offs], data, count);
+}
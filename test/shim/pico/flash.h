@@ -0,0 +1,19 @@
+#ifndef HOST_SHIM_PICO_FLASH__H
+#define HOST_SHIM_PICO_FLASH__H
+
+#include "pico/stdlib.h"
+
+#define PICO_OK 0
+
+static inline bool flash_safe_execute_core_init(void){
+  return true;
+}
+
+// No other core to park on the host
+static inline int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms){
+  (void) enter_exit_timeout_ms;
+  func(param);
+  return PICO_OK;
+}
+
+#endif //HOST_SHIM_PICO_FLASH__H
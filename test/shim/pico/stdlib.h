@@ -0,0 +1,81 @@
+#ifndef HOST_SHIM_PICO_STDLIB__H
+#define HOST_SHIM_PICO_STDLIB__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//--------------------------------------------------------------------+
+// Host stand-in for the Pico SDK
+//--------------------------------------------------------------------+
+
+// Only what the modules under test use. Time is virtual and only moves when a test moves it,
+// so every timing in a test is exact and repeatable
+
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+
+#define __force_inline inline __attribute__((always_inline))
+#define __not_in_flash(group)
+#define __not_in_flash_func(func) func
+
+extern uint64_t host_time_us;
+void host_time_advance_us(uint64_t delay_us);
+
+static inline uint32_t time_us_32(void){
+  return (uint32_t) host_time_us;
+}
+
+static inline uint64_t time_us_64(void){
+  return host_time_us;
+}
+
+static inline absolute_time_t get_absolute_time(void){
+  return host_time_us;
+}
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t){
+  return (uint32_t) (t / 1000);
+}
+
+static inline void busy_wait_us_32(uint32_t delay_us){
+  host_time_advance_us(delay_us);
+}
+
+// A spinning loop lets virtual time pass
+static inline void tight_loop_contents(void){
+  host_time_advance_us(1);
+}
+
+static inline uint get_core_num(void){
+  return 0;
+}
+
+// Driven levels are kept in host_gpio_out. Inputs are read through host_gpio_in, which a test
+// sets to wire its keys to the driven columns; without it every input reads low (keys released)
+#define GPIO_IN 0
+#define GPIO_OUT 1
+
+extern uint32_t host_gpio_out;
+extern uint32_t (*host_gpio_in)(uint32_t gpio_out);
+
+static inline void gpio_init(uint gpio){ (void) gpio; }
+static inline void gpio_set_dir(uint gpio, bool out){ (void) gpio; (void) out; }
+
+static inline void gpio_put(uint gpio, bool value){
+  if(value){
+    host_gpio_out |= 1u << gpio;
+  }else{
+    host_gpio_out &= ~(1u << gpio);
+  }
+}
+
+static inline uint32_t gpio_get_all(void){
+  return host_gpio_in ? host_gpio_in(host_gpio_out) : 0;
+}
+
+static inline bool gpio_get(uint gpio){
+  return (gpio_get_all() >> gpio) & 1u;
+}
+
+#endif //HOST_SHIM_PICO_STDLIB__H
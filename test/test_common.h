@@ -0,0 +1,40 @@
+#ifndef TEST_COMMON__H
+#define TEST_COMMON__H
+
+#include <stdio.h>
+
+//--------------------------------------------------------------------+
+// Checks
+//--------------------------------------------------------------------+
+
+// A failed check is reported and counted, the test goes on so one run shows every failure
+static int test_failures = 0;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      test_failures++; \
+    } \
+  }while(0)
+
+#define CHECK_EQ(actual, expected) do{ \
+    long long const check_actual_ = (long long) (actual); \
+    long long const check_expected_ = (long long) (expected); \
+    if(check_actual_ != check_expected_){ \
+      printf("%s:%d: check failed: %s == %lld, expected %s == %lld\n", __FILE__, __LINE__, \
+             #actual, check_actual_, #expected, check_expected_); \
+      test_failures++; \
+    } \
+  }while(0)
+
+#define RUN_TEST(test) do{ \
+    printf("-- %s\n", #test); \
+    test(); \
+  }while(0)
+
+static inline int test_result(void){
+  printf("%s: %d failed checks\n", test_failures ? "FAIL" : "PASS", test_failures);
+  return test_failures ? 1 : 0;
+}
+
+#endif //TEST_COMMON__H
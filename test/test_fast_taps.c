@@ -0,0 +1,316 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "test_common.h"
+#include "mock_dcd.h"
+
+// The firmware with its statics in reach: core1_scan_task(), hid_task() and their state
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#include "fw_harness.h"
+
+extern const uint kb_key_codes[KB_NUM_OF_ROWS][KB_NUM_OF_COLS];
+
+//--------------------------------------------------------------------+
+// Fingers: sub-ms taps with contact bounce on both edges
+//--------------------------------------------------------------------+
+
+// Longest core1 scan pass: every column waits KB_COL_SETTLE_US on the timer
+#define SCAN_US 200
+// Taps last 200 to 900 us, so every one is seen by at least one scan, every edge chatters for this long
+#define TAP_MIN_US SCAN_US
+#define TAP_MAX_US 900
+#define BOUNCE_US 400
+// A key is tapped again once its press and release lockouts are over, then after up to this long
+#define TAP_GAP_MAX_US 20000
+#define RUN_US 5000000
+
+// Q to I and A to K: no modifier, no Fn, one column apart
+#define NUM_OF_FINGERS 8
+static uint8_t const finger_keys[NUM_OF_FINGERS][2] = {
+  {1, 1}, {1, 2}, {1, 3}, {1, 4}, {2, 1}, {2, 2}, {2, 3}, {2, 4}
+};
+
+typedef struct
+{
+  uint32_t start_us;     /**< Contact closes, it chatters for BOUNCE_US before. */
+  uint32_t end_us;       /**< Contact opens, it chatters for BOUNCE_US after. */
+  uint32_t taps;
+} finger_t;
+
+static finger_t fingers[NUM_OF_FINGERS];
+static uint32_t fingers_stop_us;
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng(void){
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void finger_schedule(finger_t* finger, uint32_t earliest_us){
+  finger->start_us = earliest_us + rng() % TAP_GAP_MAX_US;
+  if(finger->start_us >= fingers_stop_us){
+    // No new tap starts chattering, the ones in flight finish
+    finger->start_us = finger->end_us = UINT32_MAX - BOUNCE_US;
+    return;
+  }
+  finger->end_us = finger->start_us + TAP_MIN_US + rng() % (TAP_MAX_US - TAP_MIN_US);
+  finger->taps++;
+}
+
+static bool finger_contact(finger_t* finger, uint32_t now_us){
+  if(now_us >= finger->end_us + BOUNCE_US){
+    // Lockouts of the last tap: press (from the first chatter) and release, one scan of margin
+    finger_schedule(finger, finger->start_us - BOUNCE_US + 2 * KB_DEBOUNCE_US + SCAN_US + BOUNCE_US);
+  }
+  if((now_us >= finger->start_us) && (now_us < finger->end_us)) return true;
+  if((now_us + BOUNCE_US >= finger->start_us) && (now_us < finger->end_us + BOUNCE_US)) return rng() & 1;
+  return false;
+}
+
+static void fingers_keys(kb_matrix_t* keys, uint32_t now_us){
+  for(uint finger_idx = 0; finger_idx < NUM_OF_FINGERS; finger_idx++){
+    if(finger_contact(&fingers[finger_idx], now_us)){
+      keys->rows[finger_keys[finger_idx][0]] |= (kb_row_mask_t) (1u << finger_keys[finger_idx][1]);
+    }
+  }
+}
+
+static uint8_t finger_keycode(uint finger_idx){
+  return (uint8_t) kb_key_codes[finger_keys[finger_idx][0]][finger_keys[finger_idx][1]];
+}
+
+static bool nkro_key(hid_nkro_report_t const* report, uint8_t keycode){
+  return report->keys[keycode / 8] & (1u << (keycode % 8));
+}
+
+//--------------------------------------------------------------------+
+// Key changes per finger: debounced by core1 and seen by the host
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  hid_nkro_report_t report;
+  uint32_t presses[NUM_OF_FINGERS];
+  uint32_t releases[NUM_OF_FINGERS];
+  uint8_t press_order[4096];
+  uint press_count;
+} key_log_t;
+
+static key_log_t core1_log;
+static key_log_t host_log;
+
+static void key_log_update(key_log_t* log, hid_nkro_report_t const* report){
+  for(uint finger_idx = 0; finger_idx < NUM_OF_FINGERS; finger_idx++){
+    bool const was = nkro_key(&log->report, finger_keycode(finger_idx));
+    bool const is = nkro_key(report, finger_keycode(finger_idx));
+    if(is && !was){
+      log->presses[finger_idx]++;
+      if(log->press_count < sizeof(log->press_order)) log->press_order[log->press_count++] = (uint8_t) finger_idx;
+    }
+    if(!is && was) log->releases[finger_idx]++;
+  }
+  log->report = *report;
+}
+
+// Every NKRO report the host polls, with the time it arrived
+#define MAX_HOST_REPORTS 16
+static hid_nkro_report_t host_reports[MAX_HOST_REPORTS];
+static uint32_t host_reports_us[MAX_HOST_REPORTS];
+static uint num_of_host_reports = 0;
+
+static void host_on_report(uint8_t ep_addr, uint8_t const* report, uint16_t len){
+  if((ep_addr != (0x81 + ITF_NUM_NKRO)) || (len != sizeof(hid_nkro_report_t))) return;
+
+  hid_nkro_report_t const* nkro = (hid_nkro_report_t const*) report;
+  key_log_update(&host_log, nkro);
+  if(num_of_host_reports < MAX_HOST_REPORTS){
+    host_reports[num_of_host_reports] = *nkro;
+    host_reports_us[num_of_host_reports] = time_us_32();
+  }
+  num_of_host_reports++;
+}
+
+// fw_step() with the debounced changes logged as core1 queues them
+static void step(void){
+  fw_step();
+  key_log_update(&core1_log, &core1_last_payload.nkro);
+}
+
+static void run_us(uint32_t duration_us){
+  uint64_t const end_us = host_time_us + duration_us;
+  while(host_time_us < end_us) step();
+}
+
+//--------------------------------------------------------------------+
+// Re-taps during the lockouts: one key, no bounce
+//--------------------------------------------------------------------+
+
+// Contact intervals of the key, relative to the start of the case
+typedef struct
+{
+  uint32_t start_us;
+  uint32_t end_us;
+} contact_t;
+
+static contact_t const* contacts;
+static uint num_of_contacts;
+static uint32_t contacts_start_us;
+
+static void contacts_keys(kb_matrix_t* keys, uint32_t now_us){
+  for(uint i = 0; i < num_of_contacts; i++){
+    if((now_us - contacts_start_us >= contacts[i].start_us) && (now_us - contacts_start_us < contacts[i].end_us)){
+      keys->rows[finger_keys[0][0]] |= (kb_row_mask_t) (1u << finger_keys[0][1]);
+    }
+  }
+}
+
+// Expected host report: the key pressed or not, arriving in [earliest_us, earliest_us + LATENCY_US)
+typedef struct
+{
+  bool pressed;
+  uint32_t earliest_us;
+} expected_t;
+
+// A scan, the queue to core0 and the next 1 ms poll
+#define LATENCY_US 2000
+
+static void run_contacts(contact_t const* case_contacts, uint case_num_of_contacts,
+                         expected_t const* expected, uint num_of_expected){
+  contacts = case_contacts;
+  num_of_contacts = case_num_of_contacts;
+  num_of_host_reports = 0;
+  fw_keys_cb = contacts_keys;
+  // Scan boundaries fall anywhere in the case: the lockout starts at the scan that saw the edge
+  contacts_start_us = time_us_32();
+
+  run_us(contacts[num_of_contacts - 1].end_us + 2 * KB_DEBOUNCE_US + LATENCY_US);
+
+  CHECK_EQ(num_of_host_reports, num_of_expected);
+  for(uint i = 0; (i < num_of_expected) && (i < num_of_host_reports); i++){
+    uint32_t const at_us = host_reports_us[i] - contacts_start_us;
+    CHECK_EQ(nkro_key(&host_reports[i], finger_keycode(0)), expected[i].pressed);
+    if((at_us < expected[i].earliest_us) || (at_us >= expected[i].earliest_us + LATENCY_US)){
+      printf("report %u at %lu us, expected from %lu us\n", i, (unsigned long) at_us, (unsigned long) expected[i].earliest_us);
+      CHECK(false);
+    }
+  }
+  fw_keys_cb = NULL;
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+
+static void test_enumerate(void){
+  CHECK(mock_host_enumerate());
+  run_us(10000);
+  CHECK(tud_mounted());
+  CHECK_EQ(tud_hid_n_get_protocol(ITF_NUM_KEYBOARD), HID_PROTOCOL_REPORT);
+
+  uint64_t const start_us = host_time_us;
+  core1_scan_task();
+  printf("scan pass: %lu us\n", (unsigned long) (host_time_us - start_us));
+  CHECK(host_time_us - start_us <= SCAN_US);
+}
+
+static void test_every_fast_tap_reaches_the_host_in_order(void){
+  uint32_t const start_us = time_us_32();
+  fingers_stop_us = start_us + RUN_US;
+  for(uint finger_idx = 0; finger_idx < NUM_OF_FINGERS; finger_idx++){
+    finger_schedule(&fingers[finger_idx], start_us);
+  }
+  hid_payload_overflows = 0;
+  hid_payload_coalesced = 0;
+  fw_keys_cb = fingers_keys;
+
+  // The last taps in flight finish and are sent
+  run_us(RUN_US + TAP_GAP_MAX_US + 2 * KB_DEBOUNCE_US + LATENCY_US);
+  fw_keys_cb = NULL;
+
+  uint32_t taps = 0;
+  for(uint finger_idx = 0; finger_idx < NUM_OF_FINGERS; finger_idx++){
+    uint32_t const finger_taps = fingers[finger_idx].taps;
+    taps += finger_taps;
+    CHECK_EQ(core1_log.presses[finger_idx], finger_taps);
+    CHECK_EQ(core1_log.releases[finger_idx], finger_taps);
+    CHECK_EQ(host_log.presses[finger_idx], finger_taps);
+    CHECK_EQ(host_log.releases[finger_idx], finger_taps);
+  }
+  printf("%lu taps, %lu payloads coalesced\n", (unsigned long) taps, (unsigned long) hid_payload_coalesced);
+
+  // Presses are never merged: the host sees them in the order they were debounced
+  CHECK_EQ(host_log.press_count, core1_log.press_count);
+  CHECK(memcmp(host_log.press_order, core1_log.press_order, core1_log.press_count) == 0);
+  CHECK_EQ(hid_payload_overflows, 0);
+  CHECK(hid_payload_coalesced > 0);
+  CHECK(taps > 1000);
+}
+
+// The change is taken at once and the key then ignores its contact for KB_DEBOUNCE_US.
+// Whatever it did meanwhile only counts if it still holds when the lockout is over
+static void test_retap_in_press_lockout(void){
+  // Released and tapped again while the press is locked: one tap, released at the lockout end
+  contact_t const retap[] = { { 0, 300 }, { 1500, 2000 } };
+  expected_t const retap_expected[] = { { true, 0 }, { false, KB_DEBOUNCE_US } };
+  run_contacts(retap, TU_ARRAY_SIZE(retap), retap_expected, TU_ARRAY_SIZE(retap_expected));
+
+  // Tapped again and held past the lockout: one long press, released when the contact opens
+  contact_t const hold[] = { { 0, 300 }, { 1500, 8000 } };
+  expected_t const hold_expected[] = { { true, 0 }, { false, 8000 } };
+  run_contacts(hold, TU_ARRAY_SIZE(hold), hold_expected, TU_ARRAY_SIZE(hold_expected));
+}
+
+static void test_retap_in_release_lockout(void){
+  // A tap within KB_DEBOUNCE_US of the release is taken for bounce and never reaches the host
+  contact_t const retap[] = { { 0, 10000 }, { 11000, 12000 } };
+  expected_t const retap_expected[] = { { true, 0 }, { false, 10000 } };
+  run_contacts(retap, TU_ARRAY_SIZE(retap), retap_expected, TU_ARRAY_SIZE(retap_expected));
+
+  // Pressed again and held past the lockout: a second press at the lockout end
+  contact_t const hold[] = { { 0, 10000 }, { 11000, 30000 } };
+  expected_t const hold_expected[] = { { true, 0 }, { false, 10000 }, { true, 10000 + KB_DEBOUNCE_US }, { false, 30000 } };
+  run_contacts(hold, TU_ARRAY_SIZE(hold), hold_expected, TU_ARRAY_SIZE(hold_expected));
+}
+
+static void test_only_releases_boot_protocol(void){
+  kb_hid_payload_t from;
+  kb_hid_payload_t to;
+  memset(&from, 0, sizeof(from));
+  memset(&to, 0, sizeof(to));
+
+  // The boot report lists keys by position: a key moving to another slot is no press
+  from.boot.keycode[0] = HID_KEY_A;
+  from.boot.keycode[1] = HID_KEY_B;
+  to.boot.keycode[0] = HID_KEY_B;
+  CHECK(kb_hid_payload_only_releases(&from, &to, true));
+
+  to.boot.keycode[1] = HID_KEY_C;
+  CHECK(!kb_hid_payload_only_releases(&from, &to, true));
+
+  to.boot.keycode[1] = HID_KEY_NONE;
+  to.boot.modifier = KEYBOARD_MODIFIER_LEFTSHIFT;
+  CHECK(!kb_hid_payload_only_releases(&from, &to, true));
+
+  // The report of the other protocol is not looked at
+  to.boot.modifier = 0;
+  to.nkro.keys[0] = 0x01;
+  CHECK(kb_hid_payload_only_releases(&from, &to, true));
+  CHECK(!kb_hid_payload_only_releases(&from, &to, false));
+}
+
+int main(void){
+  fw_init();
+  mock_host_on_report(host_on_report);
+
+  RUN_TEST(test_enumerate);
+  RUN_TEST(test_every_fast_tap_reaches_the_host_in_order);
+  RUN_TEST(test_retap_in_press_lockout);
+  RUN_TEST(test_retap_in_release_lockout);
+  RUN_TEST(test_only_releases_boot_protocol);
+  return test_result();
+}
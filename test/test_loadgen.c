@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "test_common.h"
+#include "mock_dcd.h"
+
+// The firmware with its statics in reach: core1_scan_task(), hid_task() and their state
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#include "fw_harness.h"
+
+extern const uint kb_key_codes[KB_NUM_OF_ROWS][KB_NUM_OF_COLS];
+
+//--------------------------------------------------------------------+
+// Workloads
+//--------------------------------------------------------------------+
+
+// Scripted key presses on the scanned GPIOs. They go through the real scan, debounce, core1 ->
+// core0 queue, hid_task() and TinyUSB to the host, which checks every NKRO report it polls
+// against the intended edges.
+
+typedef struct
+{
+  char const* name;
+  uint32_t duration_ms;
+  uint32_t interval_us;  /**< Time between two presses. */
+  uint32_t hold_us;      /**< How long every press is held. */
+  bool whole_row;        /**< Press all letter keys of MASH_ROW at once instead of one key. */
+  uint8_t bounces;       /**< Times the contact goes back to the old state after every edge. */
+} workload_t;
+
+// Presses walk through the letter keys, so consecutive presses are always different keys
+static workload_t const workloads[] =
+{
+  { "typing 20 keys/s",  10000, 50000,  80000,  false, 0 },
+  { "macro 200 keys/s",  10000, 5000,   3000,   false, 0 },
+  { "row mash",          10000, 100000, 30000,  true,  0 },
+  { "chatter",           10000, 50000,  80000,  false, 3 },
+};
+
+// Time each key is toggled back and forth after an edge in the chatter workload
+#define BOUNCE_US 300
+// Row pressed at once by the row mash workload
+#define MASH_ROW 2
+// Quiet time after a workload: the last release waits out the lockout, then its report goes out
+#define TAIL_US (KB_DEBOUNCE_US + 50000)
+// Edges due closer than this may reach the host in either order: a scan reads the columns
+// one after the other, and a lockout starts at the scan that saw the edge
+#define ORDER_SLACK_US 400
+
+#define MAX_EDGES 8192
+
+static uint8_t keys[KB_NUM_OF_ROWS * KB_NUM_OF_COLS][2];
+static uint num_of_keys = 0;
+static kb_row_mask_t mash_mask = 0;
+
+static workload_t const* workload = NULL;
+static uint32_t workload_start_us;
+
+static void init_keys(void){
+  for(uint8_t row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    for(uint8_t col_idx = 0; col_idx < KB_NUM_OF_COLS; col_idx++){
+      uint const keycode = kb_key_codes[row_idx][col_idx];
+      if((keycode < HID_KEY_A) || (keycode > HID_KEY_Z)) continue;
+
+      keys[num_of_keys][0] = row_idx;
+      keys[num_of_keys][1] = col_idx;
+      num_of_keys++;
+      if(row_idx == MASH_ROW) mash_mask |= (kb_row_mask_t) (1u << col_idx);
+    }
+  }
+}
+
+static void press_keys(uint32_t press, uint8_t* row_idx, kb_row_mask_t* mask){
+  if(workload->whole_row){
+    *row_idx = MASH_ROW;
+    *mask = mash_mask;
+  }else{
+    *row_idx = keys[press % num_of_keys][0];
+    *mask = (kb_row_mask_t) (1u << keys[press % num_of_keys][1]);
+  }
+}
+
+// Raw contacts, bounces included: odd bounce phases after an edge go back to the old state
+static void workload_keys(kb_matrix_t* matrix, uint32_t now_us){
+  if(workload == NULL) return;
+
+  uint32_t const t_us = now_us - workload_start_us;
+  uint32_t const duration_us = workload->duration_ms * 1000;
+  // Only the presses that can still be held or bouncing are looked at
+  uint32_t const last_press = t_us / workload->interval_us;
+  uint32_t const overlap = (workload->hold_us + 2u * workload->bounces * BOUNCE_US) / workload->interval_us + 1;
+  for(uint32_t press = (last_press > overlap) ? (last_press - overlap) : 0; press <= last_press; press++){
+    uint32_t const start_us = press * workload->interval_us;
+    uint32_t const end_us = start_us + workload->hold_us;
+    if(start_us >= duration_us) break;
+
+    bool const pressed = (t_us < end_us);
+    uint32_t const phase = (t_us - (pressed ? start_us : end_us)) / BOUNCE_US;
+    bool const bouncing = (phase < 2u * workload->bounces) && (phase & 1);
+    if(pressed != bouncing){
+      uint8_t row_idx;
+      kb_row_mask_t mask;
+      press_keys(press, &row_idx, &mask);
+      matrix->rows[row_idx] |= mask;
+    }
+  }
+}
+
+//--------------------------------------------------------------------+
+// Host: matching the NKRO reports against the intended edges
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint32_t ts_us;       /**< Contact edge, before any bounce. */
+  uint32_t due_us;      /**< Earliest the debounce can pass it on: a release waits for the press lockout. */
+  uint8_t keycode;
+  bool pressed;
+  bool matched;
+  bool reordered;
+} edge_t;
+
+static edge_t edges[MAX_EDGES];
+static uint num_of_edges = 0;
+static uint first_unmatched = 0;
+
+static hid_nkro_report_t host_report;
+static uint32_t latencies_us[MAX_EDGES];
+
+static struct
+{
+  uint32_t matched;
+  uint32_t spurious;     /**< Key changes in reports no edge asked for. */
+  uint32_t duplicated;   /**< Reports equal to the previous one. */
+  uint32_t reordered;    /**< Edges that reached the host after one due later than them. */
+  uint32_t max_after_due_us;
+} stats;
+
+static int edge_cmp(void const* a, void const* b){
+  edge_t const* edge_a = (edge_t const*) a;
+  edge_t const* edge_b = (edge_t const*) b;
+  if(edge_a->due_us != edge_b->due_us) return (edge_a->due_us < edge_b->due_us) ? -1 : 1;
+  if(edge_a->ts_us != edge_b->ts_us) return (edge_a->ts_us < edge_b->ts_us) ? -1 : 1;
+  return (int) edge_a->keycode - (int) edge_b->keycode;
+}
+
+static void add_edge(uint32_t ts_us, uint32_t due_us, uint8_t keycode, bool pressed){
+  if(num_of_edges == MAX_EDGES) return;
+  edges[num_of_edges++] = (edge_t) { .ts_us = ts_us, .due_us = due_us, .keycode = keycode, .pressed = pressed };
+}
+
+// Every edge of the workload, in the order the host must see them
+static void build_edges(void){
+  num_of_edges = 0;
+  first_unmatched = 0;
+  uint32_t const duration_us = workload->duration_ms * 1000;
+  for(uint32_t press = 0; press * workload->interval_us < duration_us; press++){
+    uint32_t const start_us = workload_start_us + press * workload->interval_us;
+    uint32_t const end_us = start_us + workload->hold_us;
+    uint8_t row_idx;
+    kb_row_mask_t mask;
+    press_keys(press, &row_idx, &mask);
+    for(uint col_idx = 0; col_idx < KB_NUM_OF_COLS; col_idx++){
+      if(!(mask & (1u << col_idx))) continue;
+      uint8_t const keycode = (uint8_t) kb_key_codes[row_idx][col_idx];
+      add_edge(start_us, start_us, keycode, true);
+      add_edge(end_us, tu_max32(end_us, start_us + KB_DEBOUNCE_US), keycode, false);
+    }
+  }
+  qsort(edges, num_of_edges, sizeof(edges[0]), edge_cmp);
+}
+
+static bool nkro_key(hid_nkro_report_t const* report, uint8_t keycode){
+  return report->keys[keycode / 8] & (1u << (keycode % 8));
+}
+
+static void match(uint8_t keycode, bool pressed, uint32_t now_us, uint32_t* max_due_us){
+  // Oldest edge of the key first, the edges of one key alternate
+  for(uint i = first_unmatched; i < num_of_edges; i++){
+    edge_t* edge = &edges[i];
+    if(edge->matched || (edge->keycode != keycode)) continue;
+    if((edge->pressed != pressed) || (edge->ts_us > now_us)) break;
+
+    edge->matched = true;
+    latencies_us[stats.matched++] = now_us - edge->ts_us;
+    if((now_us > edge->due_us) && (now_us - edge->due_us > stats.max_after_due_us)) stats.max_after_due_us = now_us - edge->due_us;
+    if(edge->due_us > *max_due_us) *max_due_us = edge->due_us;
+    return;
+  }
+  stats.spurious++;
+}
+
+static void host_on_report(uint8_t ep_addr, uint8_t const* report, uint16_t len){
+  if((workload == NULL) || (ep_addr != (0x81 + ITF_NUM_NKRO)) || (len != sizeof(hid_nkro_report_t))) return;
+
+  hid_nkro_report_t const* nkro = (hid_nkro_report_t const*) report;
+  if(memcmp(nkro, &host_report, sizeof(host_report)) == 0){
+    stats.duplicated++;
+    return;
+  }
+
+  uint32_t const now_us = time_us_32();
+  uint32_t max_due_us = 0;
+  for(uint keycode = 0; keycode < USB_HID_NKRO_NUM_OF_KEYS; keycode++){
+    bool const pressed = nkro_key(nkro, (uint8_t) keycode);
+    if(pressed != nkro_key(&host_report, (uint8_t) keycode)) match((uint8_t) keycode, pressed, now_us, &max_due_us);
+  }
+  host_report = *nkro;
+
+  // An edge still missing that was due well before one that just arrived comes out of order
+  while((first_unmatched < num_of_edges) && edges[first_unmatched].matched) first_unmatched++;
+  for(uint i = first_unmatched; (i < num_of_edges) && (edges[i].due_us + ORDER_SLACK_US < max_due_us); i++){
+    if(!edges[i].matched && !edges[i].reordered){
+      edges[i].reordered = true;
+      stats.reordered++;
+    }
+  }
+}
+
+static int latency_cmp(void const* a, void const* b){
+  uint32_t const latency_a = *(uint32_t const*) a;
+  uint32_t const latency_b = *(uint32_t const*) b;
+  return (latency_a > latency_b) - (latency_a < latency_b);
+}
+
+static uint32_t latency_percentile_us(uint32_t permille){
+  if(stats.matched == 0) return 0;
+  return latencies_us[(stats.matched - 1) * permille / 1000];
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+
+static void run_workload(workload_t const* w){
+  memset(&stats, 0, sizeof(stats));
+  hid_payload_overflows = 0;
+  workload = w;
+  workload_start_us = time_us_32();
+  build_edges();
+
+  fw_run_us(workload->duration_ms * 1000 + workload->hold_us + 2u * workload->bounces * BOUNCE_US + TAIL_US);
+
+  uint32_t dropped = 0;
+  for(uint i = 0; i < num_of_edges; i++){
+    if(!edges[i].matched) dropped++;
+  }
+  qsort(latencies_us, stats.matched, sizeof(latencies_us[0]), latency_cmp);
+  printf("%s: edges=%u dropped=%lu spurious=%lu duplicated=%lu reordered=%lu "
+         "latency p50=%lu us p99=%lu us max=%lu us, max after due=%lu us\n",
+         workload->name, num_of_edges, (unsigned long) dropped, (unsigned long) stats.spurious,
+         (unsigned long) stats.duplicated, (unsigned long) stats.reordered,
+         (unsigned long) latency_percentile_us(500), (unsigned long) latency_percentile_us(990),
+         (unsigned long) latency_percentile_us(1000), (unsigned long) stats.max_after_due_us);
+
+  CHECK(num_of_edges > 0);
+  CHECK(num_of_edges < MAX_EDGES);
+  CHECK_EQ(stats.matched, num_of_edges);
+  CHECK_EQ(dropped, 0);
+  CHECK_EQ(stats.spurious, 0);
+  CHECK_EQ(stats.duplicated, 0);
+  CHECK_EQ(stats.reordered, 0);
+  CHECK_EQ(hid_payload_overflows, 0);
+  // A scan, the queue to core0 and a report per 1 ms frame
+  CHECK(stats.max_after_due_us <= 3000);
+
+  workload = NULL;
+}
+
+static void test_workloads(void){
+  CHECK(mock_host_enumerate());
+  fw_run_us(10000);
+  CHECK(tud_mounted());
+  CHECK_EQ(tud_hid_n_get_protocol(ITF_NUM_KEYBOARD), HID_PROTOCOL_REPORT);
+
+  for(uint i = 0; i < TU_ARRAY_SIZE(workloads); i++){
+    run_workload(&workloads[i]);
+  }
+}
+
+int main(void){
+  init_keys();
+  fw_init();
+  fw_keys_cb = workload_keys;
+  mock_host_on_report(host_on_report);
+
+  RUN_TEST(test_workloads);
+  return test_result();
+}
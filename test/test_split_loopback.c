@@ -0,0 +1,292 @@
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "pico/stdlib.h"
+#include "test_common.h"
+#include "kb_split.h"
+
+//--------------------------------------------------------------------+
+// Both halves of kb_split.c, built under their own names (add_split_half in CMakeLists.txt)
+//--------------------------------------------------------------------+
+
+void primary_kb_split_init(void);
+void primary_kb_split_merge_remote(kb_matrix_t* matrix);
+kb_split_stats_t primary_kb_split_get_stats(void);
+void primary_kb_split_rx_byte(uint8_t byte);
+
+void secondary_kb_split_init(void);
+void secondary_kb_split_send_matrix(kb_matrix_t const* matrix);
+kb_split_stats_t secondary_kb_split_get_stats(void);
+void secondary_kb_split_rx_byte(uint8_t byte);
+
+//--------------------------------------------------------------------+
+// Wire: a socketpair, the primary owns end 0 and the secondary end 1
+//--------------------------------------------------------------------+
+
+// 2 Mbaud, 10 bits per byte
+#define WIRE_US_PER_BYTE 5
+
+enum
+{
+  FAULT_NONE = 0,
+  FAULT_FLIP_BIT,     /**< One payload bit of the next frame is flipped. */
+  FAULT_DROP_FRAME,   /**< The next frame never arrives. */
+  FAULT_GARBAGE,      /**< Noise with a false start of frame goes ahead of the next frame. */
+};
+
+static int wire[2];
+// Applied to the next frame of the secondary, then cleared
+static int secondary_fault = FAULT_NONE;
+// Added once per frame delivered, on top of the wire time
+static uint32_t extra_delay_us = 0;
+// Length of the frames the secondary wrote, last one first
+static uint secondary_frame_len = 0;
+static uint secondary_frame_count = 0;
+
+void primary_kb_split_port_init(void){
+}
+
+void primary_kb_split_port_write(uint8_t const* data, uint len){
+  CHECK_EQ(write(wire[0], data, len), len);
+}
+
+void secondary_kb_split_port_init(void){
+}
+
+void secondary_kb_split_port_write(uint8_t const* data, uint len){
+  uint8_t frame[KB_SPLIT_MAX_FRAME_LEN];
+  memcpy(frame, data, len);
+  secondary_frame_len = len;
+  secondary_frame_count++;
+
+  int const fault = secondary_fault;
+  secondary_fault = FAULT_NONE;
+  switch(fault){
+    case FAULT_FLIP_BIT:{
+      frame[3] ^= 0x10;
+      break;
+    }
+    case FAULT_DROP_FRAME:{
+      return;
+    }
+    case FAULT_GARBAGE:{
+      uint8_t const noise[] = { 0x00, KB_SPLIT_SOF, 0x13 };
+      CHECK_EQ(write(wire[1], noise, sizeof(noise)), sizeof(noise));
+      break;
+    }
+    default: break;
+  }
+  CHECK_EQ(write(wire[1], frame, len), len);
+}
+
+// Feeds what is waiting on one end to its half, one byte per wire time
+static bool deliver(int fd, void (*rx_byte)(uint8_t)){
+  uint8_t buf[64];
+  ssize_t const len = read(fd, buf, sizeof(buf));
+  if(len <= 0) return false;
+
+  host_time_advance_us(extra_delay_us);
+  for(ssize_t i = 0; i < len; i++){
+    host_time_advance_us(WIRE_US_PER_BYTE);
+    rx_byte(buf[i]);
+  }
+  return true;
+}
+
+// Until nothing is in flight: replies such as NAK and PONG are written while receiving
+static void pump(void){
+  bool moved;
+  do{
+    moved = deliver(wire[1], secondary_kb_split_rx_byte);
+    moved = deliver(wire[0], primary_kb_split_rx_byte) || moved;
+  }while(moved);
+}
+
+//--------------------------------------------------------------------+
+// Halves
+//--------------------------------------------------------------------+
+
+static kb_matrix_t secondary_matrix;
+
+static kb_matrix_t primary_view(void){
+  kb_matrix_t matrix;
+  memset(&matrix, 0, sizeof(matrix));
+  primary_kb_split_merge_remote(&matrix);
+  return matrix;
+}
+
+static bool primary_in_sync(void){
+  kb_matrix_t const matrix = primary_view();
+  return memcmp(&matrix, &secondary_matrix, sizeof(matrix)) == 0;
+}
+
+// One scan of the secondary half, the frame crosses the wire before the next one
+static void secondary_scan(void){
+  secondary_kb_split_send_matrix(&secondary_matrix);
+  pump();
+}
+
+// Time passes with both halves scanning, the secondary's full syncs keep the link up
+static void scan_for_ms(uint32_t duration_ms){
+  for(uint32_t elapsed_ms = 0; elapsed_ms < duration_ms; elapsed_ms += 10){
+    host_time_advance_us(10 * 1000);
+    secondary_scan();
+    primary_view();
+    pump();
+  }
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+
+static void test_full_sync_then_deltas(void){
+  // The first frame after boot is a full sync
+  secondary_matrix.rows[0] = 0x0001;
+  secondary_scan();
+  CHECK_EQ(secondary_frame_len, 4 + 1 + 2 * KB_NUM_OF_ROWS);
+  CHECK(primary_in_sync());
+
+  // Only the changed row goes out
+  secondary_matrix.rows[2] = 0x4000;
+  secondary_scan();
+  CHECK_EQ(secondary_frame_len, 4 + 1 + 2);
+  CHECK(primary_in_sync());
+
+  // Nothing changed, nothing sent
+  uint const frames = secondary_frame_count;
+  host_time_advance_us(1000);
+  secondary_scan();
+  CHECK_EQ(secondary_frame_count, frames);
+
+  // Unchanged matrices are still sent in full every KB_SPLIT_SYNC_INTERVAL_MS
+  host_time_advance_us(KB_SPLIT_SYNC_INTERVAL_MS * 1000);
+  secondary_scan();
+  CHECK_EQ(secondary_frame_count, frames + 1);
+  CHECK_EQ(secondary_frame_len, 4 + 1 + 2 * KB_NUM_OF_ROWS);
+
+  kb_split_stats_t const stats = primary_kb_split_get_stats();
+  CHECK_EQ(stats.crc_errors, 0);
+  CHECK_EQ(stats.seq_errors, 0);
+}
+
+static void test_crc_error_is_nakked_and_resynced(void){
+  kb_split_stats_t const primary_before = primary_kb_split_get_stats();
+  kb_split_stats_t const secondary_before = secondary_kb_split_get_stats();
+
+  secondary_fault = FAULT_FLIP_BIT;
+  secondary_matrix.rows[1] = 0x0004;
+  secondary_scan();
+
+  // Dropped, answered with a NAK
+  kb_split_stats_t primary_stats = primary_kb_split_get_stats();
+  CHECK_EQ(primary_stats.crc_errors, primary_before.crc_errors + 1);
+  CHECK_EQ(primary_stats.frames_tx, primary_before.frames_tx + 1);
+  CHECK(!primary_in_sync());
+
+  // The NAK makes the next frame a full sync although nothing changed since
+  secondary_scan();
+  CHECK_EQ(secondary_frame_len, 4 + 1 + 2 * KB_NUM_OF_ROWS);
+  CHECK_EQ(secondary_kb_split_get_stats().full_syncs, secondary_before.full_syncs + 1);
+  CHECK(primary_in_sync());
+}
+
+static void test_lost_frame_is_resynced(void){
+  kb_split_stats_t const primary_before = primary_kb_split_get_stats();
+
+  secondary_fault = FAULT_DROP_FRAME;
+  secondary_matrix.rows[3] = 0x0100;
+  secondary_scan();
+  CHECK(!primary_in_sync());
+
+  // The next delta reveals the gap: it is applied, and a NAK asks for the lost rows
+  secondary_matrix.rows[4] = 0x0008;
+  secondary_scan();
+  CHECK_EQ(primary_kb_split_get_stats().seq_errors, primary_before.seq_errors + 1);
+  CHECK_EQ(primary_view().rows[4], 0x0008);
+  CHECK_EQ(primary_view().rows[3], 0);
+
+  secondary_scan();
+  CHECK(primary_in_sync());
+}
+
+static void test_noise_is_resynced(void){
+  kb_split_stats_t const primary_before = primary_kb_split_get_stats();
+
+  // The false start of frame eats into the real frame, which then fails its CRC
+  secondary_fault = FAULT_GARBAGE;
+  secondary_matrix.rows[0] = 0x0003;
+  secondary_scan();
+  CHECK(primary_kb_split_get_stats().crc_errors > primary_before.crc_errors);
+
+  // The receiver is back on frame boundaries for the next frame
+  for(int i = 0; (i < 3) && !primary_in_sync(); i++){
+    secondary_scan();
+  }
+  CHECK(primary_in_sync());
+}
+
+static void test_ping_latency(void){
+  // Pings go out from the primary's scan once per KB_SPLIT_PING_INTERVAL_MS
+  scan_for_ms(KB_SPLIT_PING_INTERVAL_MS);
+
+  // 8-byte PING and PONG frames at 5 us per byte
+  kb_split_stats_t stats = primary_kb_split_get_stats();
+  CHECK_EQ(stats.latency_us, 8 * WIRE_US_PER_BYTE);
+  CHECK(stats.latency_us < KB_SPLIT_LATENCY_BUDGET_US);
+  CHECK_EQ(stats.over_budget, 0);
+
+  // A slow link is reported against the budget
+  extra_delay_us = 2 * KB_SPLIT_LATENCY_BUDGET_US;
+  scan_for_ms(KB_SPLIT_PING_INTERVAL_MS);
+  extra_delay_us = 0;
+
+  stats = primary_kb_split_get_stats();
+  CHECK_EQ(stats.latency_us, 8 * WIRE_US_PER_BYTE + 2 * KB_SPLIT_LATENCY_BUDGET_US);
+  CHECK_EQ(stats.max_latency_us, stats.latency_us);
+  CHECK_EQ(stats.over_budget, 1);
+}
+
+static void test_silent_link_releases_remote_keys(void){
+  uint32_t const timeouts_before = primary_kb_split_get_stats().link_timeouts;
+  secondary_scan();
+  CHECK(primary_in_sync());
+
+  host_time_advance_us((KB_SPLIT_LINK_TIMEOUT_MS + 1) * 1000);
+  kb_matrix_t const matrix = primary_view();
+  for(int row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+    CHECK_EQ(matrix.rows[row_idx], 0);
+  }
+  CHECK_EQ(primary_kb_split_get_stats().link_timeouts, timeouts_before + 1);
+  pump();
+
+  // Back as soon as frames come in again
+  host_time_advance_us(KB_SPLIT_SYNC_INTERVAL_MS * 1000);
+  secondary_scan();
+  CHECK(primary_in_sync());
+}
+
+int main(void){
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, wire) != 0){
+    perror("socketpair");
+    return 1;
+  }
+  fcntl(wire[0], F_SETFL, O_NONBLOCK);
+  fcntl(wire[1], F_SETFL, O_NONBLOCK);
+
+  primary_kb_split_init();
+  secondary_kb_split_init();
+
+  RUN_TEST(test_full_sync_then_deltas);
+  RUN_TEST(test_crc_error_is_nakked_and_resynced);
+  RUN_TEST(test_lost_frame_is_resynced);
+  RUN_TEST(test_noise_is_resynced);
+  RUN_TEST(test_ping_latency);
+  RUN_TEST(test_silent_link_releases_remote_keys);
+
+  close(wire[0]);
+  close(wire[1]);
+  return test_result();
+}
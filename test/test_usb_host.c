@@ -0,0 +1,295 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "test_common.h"
+#include "mock_dcd.h"
+
+// The firmware's USB side with its statics in reach: callbacks, hid_task() and their state
+#define main firmware_main
+#include "main.c"
+#undef main
+
+extern const uint kb_key_codes[KB_NUM_OF_ROWS][KB_NUM_OF_COLS];
+
+//--------------------------------------------------------------------+
+// Device: core0's loop without core1, the tests queue the payloads core1 would
+//--------------------------------------------------------------------+
+
+static uint8_t const hid_intervals[ITF_NUM_TOTAL] = { 1, 1, 10, 100, 1 };
+
+#define EP_IN(itf) ((uint8_t) (0x81 + (itf)))
+
+static void device_task(void){
+  tud_task();
+  hid_task();
+}
+
+// Frames with the device serviced after each one, as its loop runs many times per frame
+static void run_frames(uint num_of_frames){
+  for(uint i = 0; i < num_of_frames; i++){
+    mock_host_frame();
+    device_task();
+  }
+}
+
+// Payload of the given keys held, as core1 builds it from the matrix
+static kb_hid_payload_t payload_with_keys(uint8_t const* keycodes, uint num_of_keycodes){
+  kb_matrix_t matrix;
+  memset(&matrix, 0, sizeof(matrix));
+  for(uint i = 0; i < num_of_keycodes; i++){
+    for(uint row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+      for(uint col_idx = 0; col_idx < KB_NUM_OF_COLS; col_idx++){
+        if(kb_key_codes[row_idx][col_idx] == keycodes[i]) matrix.rows[row_idx] |= (kb_row_mask_t) (1u << col_idx);
+      }
+    }
+  }
+  return build_kb_hid_payload(kb_matrix_to_keycodes(&matrix));
+}
+
+static void queue_key(uint8_t keycode){
+  kb_hid_payload_t const payload = payload_with_keys(&keycode, 1);
+  CHECK(kb_payload_queue_push(&hid_payload_queue, &payload));
+}
+
+static void queue_release(void){
+  kb_hid_payload_t const payload = payload_with_keys(NULL, 0);
+  CHECK(kb_payload_queue_push(&hid_payload_queue, &payload));
+}
+
+static bool nkro_report_key(mock_host_ep_t const* ep, uint8_t keycode){
+  return ep->report[1 + keycode / 8] & (1u << (keycode % 8));
+}
+
+static bool nkro_report_empty(mock_host_ep_t const* ep){
+  for(uint i = 0; i < ep->report_len; i++){
+    if(ep->report[i]) return false;
+  }
+  return true;
+}
+
+static bool set_keyboard_leds(uint8_t itf, uint8_t leds){
+  return mock_host_control(0x21, HID_REQ_CONTROL_SET_REPORT, HID_REPORT_TYPE_OUTPUT << 8, itf, 1, &leds);
+}
+
+static bool set_protocol(uint8_t protocol){
+  return mock_host_control(0x21, HID_REQ_CONTROL_SET_PROTOCOL, protocol, ITF_NUM_KEYBOARD, 0, NULL);
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+
+static void test_enumeration(void){
+  CHECK(mock_host_enumerate());
+  device_task();
+  CHECK(tud_mounted());
+  CHECK_EQ(blink_interval_ms, BLINK_MOUNTED);
+
+  tusb_desc_device_t device_desc;
+  CHECK(mock_host_control(0x80, TUSB_REQ_GET_DESCRIPTOR, TUSB_DESC_DEVICE << 8, 0, sizeof(device_desc), &device_desc));
+  CHECK_EQ(device_desc.bcdUSB, 0x0200);
+  CHECK_EQ(device_desc.bMaxPacketSize0, CFG_TUD_ENDPOINT0_SIZE);
+  CHECK_EQ(device_desc.idVendor, 0xCafe);
+  CHECK_EQ(device_desc.bNumConfigurations, 1);
+
+  // Bus powered with remote wakeup, one HID interface per report
+  uint16_t config_len;
+  uint8_t const* config = mock_host_config_desc(&config_len);
+  CHECK_EQ(config_len, config[2] | (config[3] << 8));
+  CHECK_EQ(config[4], ITF_NUM_TOTAL);
+  CHECK(config[7] & TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP);
+
+  for(uint itf = 0; itf < ITF_NUM_TOTAL; itf++){
+    mock_host_ep_t const* ep = mock_host_ep(EP_IN(itf));
+    CHECK(ep->opened);
+    CHECK_EQ(ep->interval, hid_intervals[itf]);
+
+    uint16_t desc_len;
+    uint8_t const* desc = mock_host_report_desc((uint8_t) itf, &desc_len);
+    uint8_t const* expected = tud_hid_descriptor_report_cb((uint8_t) itf);
+    CHECK(desc_len > 0);
+    CHECK(memcmp(desc, expected, desc_len) == 0);
+  }
+  CHECK(!mock_host_ep(EP_IN(ITF_NUM_TOTAL))->opened);
+
+  // Product string, UTF-16LE after the 2 byte header
+  uint16_t string_desc[32];
+  CHECK(mock_host_control(0x80, TUSB_REQ_GET_DESCRIPTOR, (TUSB_DESC_STRING << 8) | 2, 0x0409, sizeof(string_desc), string_desc));
+  char const product[] = "Pico Keyboard";
+  CHECK_EQ(mock_host_control_len(), 2 + 2 * (sizeof(product) - 1));
+  for(uint i = 0; i < sizeof(product) - 1; i++){
+    CHECK_EQ(string_desc[1 + i], product[i]);
+  }
+}
+
+static void test_report_protocol_uses_nkro(void){
+  mock_host_ep_t const* boot_ep = mock_host_ep(EP_IN(ITF_NUM_KEYBOARD));
+  mock_host_ep_t const* nkro_ep = mock_host_ep(EP_IN(ITF_NUM_NKRO));
+  uint32_t const boot_reports = boot_ep->num_of_reports;
+  uint32_t const nkro_reports = nkro_ep->num_of_reports;
+
+  CHECK_EQ(tud_hid_n_get_protocol(ITF_NUM_KEYBOARD), HID_PROTOCOL_REPORT);
+  queue_key(HID_KEY_A);
+  device_task();
+  run_frames(1);
+  CHECK_EQ(nkro_ep->num_of_reports, nkro_reports + 1);
+  CHECK(nkro_report_key(nkro_ep, HID_KEY_A));
+
+  queue_release();
+  device_task();
+  run_frames(1);
+  CHECK_EQ(nkro_ep->num_of_reports, nkro_reports + 2);
+  CHECK(nkro_report_empty(nkro_ep));
+
+  // The boot interface stays idle
+  CHECK_EQ(boot_ep->num_of_reports, boot_reports);
+}
+
+static void test_set_protocol_boot(void){
+  mock_host_ep_t const* boot_ep = mock_host_ep(EP_IN(ITF_NUM_KEYBOARD));
+  mock_host_ep_t const* nkro_ep = mock_host_ep(EP_IN(ITF_NUM_NKRO));
+
+  // As BIOS/UEFI does
+  CHECK(set_protocol(HID_PROTOCOL_BOOT));
+  CHECK_EQ(tud_hid_n_get_protocol(ITF_NUM_KEYBOARD), HID_PROTOCOL_BOOT);
+  uint8_t protocol = 0xFF;
+  CHECK(mock_host_control(0xA1, HID_REQ_CONTROL_GET_PROTOCOL, 0, ITF_NUM_KEYBOARD, 1, &protocol));
+  CHECK_EQ(protocol, HID_PROTOCOL_BOOT);
+
+  uint32_t const boot_reports = boot_ep->num_of_reports;
+  uint32_t const nkro_reports = nkro_ep->num_of_reports;
+  queue_key(HID_KEY_B);
+  device_task();
+  run_frames(1);
+  CHECK_EQ(boot_ep->num_of_reports, boot_reports + 1);
+  CHECK_EQ(boot_ep->report_len, sizeof(hid_keyboard_report_t));
+  CHECK_EQ(boot_ep->report[2], HID_KEY_B);
+
+  queue_release();
+  device_task();
+  run_frames(1);
+  CHECK_EQ(boot_ep->num_of_reports, boot_reports + 2);
+  CHECK_EQ(boot_ep->report[2], HID_KEY_NONE);
+  CHECK_EQ(nkro_ep->num_of_reports, nkro_reports);
+
+  CHECK(set_protocol(HID_PROTOCOL_REPORT));
+  CHECK_EQ(tud_hid_n_get_protocol(ITF_NUM_KEYBOARD), HID_PROTOCOL_REPORT);
+}
+
+static void test_set_report_leds(void){
+  // Caps Lock on either keyboard interface lights the LED and stops the blink
+  CHECK(set_keyboard_leds(ITF_NUM_NKRO, KEYBOARD_LED_CAPSLOCK | KEYBOARD_LED_NUMLOCK));
+  CHECK(host_led);
+  CHECK_EQ(blink_interval_ms, 0);
+
+  CHECK(set_keyboard_leds(ITF_NUM_NKRO, KEYBOARD_LED_NUMLOCK));
+  CHECK(!host_led);
+  CHECK_EQ(blink_interval_ms, BLINK_MOUNTED);
+
+  CHECK(set_keyboard_leds(ITF_NUM_KEYBOARD, KEYBOARD_LED_CAPSLOCK));
+  CHECK(host_led);
+  CHECK(set_keyboard_leds(ITF_NUM_KEYBOARD, 0));
+  CHECK(!host_led);
+  CHECK_EQ(blink_interval_ms, BLINK_MOUNTED);
+}
+
+static void test_feature_pages(void){
+  uint8_t report[USB_HID_FEATURE_REPORT_SIZE];
+  uint8_t page = 0;
+  CHECK(mock_host_control(0x21, HID_REQ_CONTROL_SET_REPORT, HID_REPORT_TYPE_FEATURE << 8, ITF_NUM_FEATURE, 1, &page));
+
+  CHECK(mock_host_control(0xA1, HID_REQ_CONTROL_GET_REPORT, HID_REPORT_TYPE_FEATURE << 8, ITF_NUM_FEATURE, sizeof(report), report));
+  CHECK_EQ(mock_host_control_len(), USB_HID_FEATURE_REPORT_SIZE);
+  CHECK_EQ(report[0], 0);
+  CHECK_EQ(report[1], FEATURE_NUM_OF_PAGES(sizeof(kb_heatmap_blob_t)));
+
+  // Reads move on to the next page
+  CHECK(mock_host_control(0xA1, HID_REQ_CONTROL_GET_REPORT, HID_REPORT_TYPE_FEATURE << 8, ITF_NUM_FEATURE, sizeof(report), report));
+  CHECK_EQ(report[0], 1 % FEATURE_NUM_OF_PAGES(sizeof(kb_heatmap_blob_t)));
+
+  // A page of no blob is not selected
+  page = 0xFF;
+  CHECK(mock_host_control(0x21, HID_REQ_CONTROL_SET_REPORT, HID_REPORT_TYPE_FEATURE << 8, ITF_NUM_FEATURE, 1, &page));
+  CHECK(mock_host_control(0xA1, HID_REQ_CONTROL_GET_REPORT, HID_REPORT_TYPE_FEATURE << 8, ITF_NUM_FEATURE, sizeof(report), report));
+  CHECK(report[0] != page);
+}
+
+static void test_poll_latency(void){
+  mock_host_ep_t const* nkro_ep = mock_host_ep(EP_IN(ITF_NUM_NKRO));
+  kb_period_reset(&hid_poll_stats[ITF_NUM_NKRO]);
+
+  // Queued 300 us into a frame, polled at the start of the next one
+  run_frames(1);
+  host_time_advance_us(300);
+  queue_key(HID_KEY_C);
+  device_task();
+  run_frames(1);
+  CHECK(nkro_report_key(nkro_ep, HID_KEY_C));
+  CHECK_EQ(nkro_ep->latency_us, 700);
+  CHECK_EQ(hid_poll_stats[ITF_NUM_NKRO].max_us, 700);
+
+  // A host polling every 8 frames: the report waits for the next frame number that is a multiple of 8
+  mock_host_set_poll_interval(EP_IN(ITF_NUM_NKRO), 8);
+  uint32_t const queued_frame = mock_host_frame_number();
+  uint32_t const poll_frame = (queued_frame / 8 + 1) * 8;
+  queue_release();
+  device_task();
+  run_frames(8);
+  CHECK(nkro_report_empty(nkro_ep));
+  CHECK_EQ(nkro_ep->latency_us, (poll_frame - queued_frame) * 1000);
+  CHECK_EQ(hid_poll_stats[ITF_NUM_NKRO].max_us, nkro_ep->latency_us);
+  mock_host_set_poll_interval(EP_IN(ITF_NUM_NKRO), hid_intervals[ITF_NUM_NKRO]);
+}
+
+static void test_suspend_remote_wakeup_and_replay(void){
+  mock_host_ep_t const* nkro_ep = mock_host_ep(EP_IN(ITF_NUM_NKRO));
+
+  CHECK(mock_host_control(0x00, TUSB_REQ_SET_FEATURE, TUSB_REQ_FEATURE_REMOTE_WAKEUP, 0, 0, NULL));
+  mock_host_suspend();
+  device_task();
+  CHECK(tud_suspended());
+  CHECK(remote_wakeup_allowed);
+  CHECK_EQ(blink_interval_ms, BLINK_SUSPENDED);
+
+  // A tap wakes the host, which takes longer than the replay window to resume
+  uint32_t const nkro_reports = nkro_ep->num_of_reports;
+  queue_key(HID_KEY_D);
+  queue_release();
+  device_task();
+  CHECK(mock_host_remote_wakeup_signalled());
+  CHECK_EQ(kb_wake_queue_count(&wake_queue), 2);
+
+  run_frames(KB_WAKE_REPLAY_TIMEOUT_MS + 500);
+  CHECK_EQ(nkro_ep->num_of_reports, nkro_reports);
+
+  mock_host_resume();
+  device_task();
+  CHECK(!tud_suspended());
+
+  // Press then release, one per frame, the press in the first frame after the resume
+  run_frames(1);
+  CHECK_EQ(nkro_ep->num_of_reports, nkro_reports + 1);
+  CHECK(nkro_report_key(nkro_ep, HID_KEY_D));
+  CHECK_EQ(nkro_ep->latency_us, 1000);
+  CHECK_EQ(resume_to_report_us, 0);
+
+  run_frames(1);
+  CHECK_EQ(nkro_ep->num_of_reports, nkro_reports + 2);
+  CHECK(nkro_report_empty(nkro_ep));
+  CHECK_EQ(kb_wake_queue_count(&wake_queue), 0);
+}
+
+int main(void){
+  kb_payload_queue_init(&hid_payload_queue);
+  for(uint i = 0; i < ITF_NUM_TOTAL; i++) kb_period_reset(&hid_poll_stats[i]);
+  tud_init(BOARD_TUD_RHPORT);
+
+  RUN_TEST(test_enumeration);
+  RUN_TEST(test_report_protocol_uses_nkro);
+  RUN_TEST(test_set_protocol_boot);
+  RUN_TEST(test_set_report_leds);
+  RUN_TEST(test_feature_pages);
+  RUN_TEST(test_poll_latency);
+  RUN_TEST(test_suspend_remote_wakeup_and_replay);
+  return test_result();
+}
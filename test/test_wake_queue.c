@@ -0,0 +1,244 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "test_common.h"
+#include "mock_dcd.h"
+
+// The firmware with its statics in reach: the suspend and resume callbacks, hid_task() and the wake queue
+#define main firmware_main
+#include "main.c"
+#undef main
+
+#include "fw_harness.h"
+
+extern const uint kb_key_codes[KB_NUM_OF_ROWS][KB_NUM_OF_COLS];
+
+//--------------------------------------------------------------------+
+// Keys tapped on the scanned GPIOs while the host sleeps
+//--------------------------------------------------------------------+
+
+typedef struct
+{
+  uint8_t keycode;
+  uint32_t start_ms;     /**< From taps_start_us. */
+  uint32_t end_ms;
+} tap_t;
+
+#define MAX_TAPS 16
+static tap_t taps[MAX_TAPS];
+static uint num_of_taps = 0;
+static uint32_t taps_start_us;
+
+static void taps_keys(kb_matrix_t* keys, uint32_t now_us){
+  uint32_t const t_ms = (now_us - taps_start_us) / 1000;
+  for(uint i = 0; i < num_of_taps; i++){
+    if((t_ms < taps[i].start_ms) || (t_ms >= taps[i].end_ms)) continue;
+    for(uint row_idx = 0; row_idx < KB_NUM_OF_ROWS; row_idx++){
+      for(uint col_idx = 0; col_idx < KB_NUM_OF_COLS; col_idx++){
+        if(kb_key_codes[row_idx][col_idx] == taps[i].keycode) keys->rows[row_idx] |= (kb_row_mask_t) (1u << col_idx);
+      }
+    }
+  }
+}
+
+// One tap of each key, hold_ms long and interval_ms apart, from now on
+static void tap_keys(uint8_t first_keycode, uint num_of_keys, uint32_t interval_ms, uint32_t hold_ms){
+  num_of_taps = 0;
+  taps_start_us = time_us_32();
+  for(uint i = 0; (i < num_of_keys) && (i < MAX_TAPS); i++){
+    taps[num_of_taps++] = (tap_t) { .keycode = (uint8_t) (first_keycode + i), .start_ms = i * interval_ms,
+                                    .end_ms = i * interval_ms + hold_ms };
+  }
+}
+
+//--------------------------------------------------------------------+
+// Host: the NKRO reports it polls after the resume
+//--------------------------------------------------------------------+
+
+static uint32_t host_keys[16];
+static uint32_t host_reports_us[16];
+static uint host_num_of_reports = 0;
+
+// First set key of the report, 0xFF if none
+static uint32_t nkro_first_key(hid_nkro_report_t const* report){
+  for(uint key = 0; key < USB_HID_NKRO_NUM_OF_KEYS; key++){
+    if(report->keys[key / 8] & (1u << (key % 8))) return key;
+  }
+  return 0xFF;
+}
+
+static void host_on_report(uint8_t ep_addr, uint8_t const* report, uint16_t len){
+  if((ep_addr != (0x81 + ITF_NUM_NKRO)) || (len != sizeof(hid_nkro_report_t))) return;
+
+  if(host_num_of_reports < TU_ARRAY_SIZE(host_keys)){
+    host_keys[host_num_of_reports] = nkro_first_key((hid_nkro_report_t const*) report);
+    host_reports_us[host_num_of_reports] = time_us_32();
+  }
+  host_num_of_reports++;
+}
+
+// A pass of both loops: a report is queued at the end of it
+#define SCAN_PASS_MAX_US 200
+
+static void run_ms(uint32_t duration_ms){
+  fw_run_us(duration_ms * 1000);
+}
+
+static void host_suspend(bool remote_wakeup){
+  CHECK(mock_host_control(0x00, remote_wakeup ? TUSB_REQ_SET_FEATURE : TUSB_REQ_CLEAR_FEATURE,
+                          TUSB_REQ_FEATURE_REMOTE_WAKEUP, 0, 0, NULL));
+  mock_host_suspend();
+  run_ms(10);
+  CHECK(tud_suspended());
+  CHECK_EQ(remote_wakeup_allowed, remote_wakeup);
+  host_num_of_reports = 0;
+}
+
+// Returns the time of the resume
+static uint32_t host_resume(void){
+  uint32_t const resume_us = time_us_32();
+  mock_host_resume();
+  run_ms(50);
+  CHECK(!tud_suspended());
+  return resume_us;
+}
+
+//--------------------------------------------------------------------+
+// Tests: tud_suspend_cb(), remote wakeup, tud_resume_cb() and the replay in hid_task()
+//--------------------------------------------------------------------+
+
+static void test_enumerate(void){
+  CHECK(mock_host_enumerate());
+  run_ms(10);
+  CHECK(tud_mounted());
+  CHECK_EQ(tud_hid_n_get_protocol(ITF_NUM_KEYBOARD), HID_PROTOCOL_REPORT);
+}
+
+static void test_key_that_woke_a_slow_host_is_replayed(void){
+  host_suspend(true);
+
+  // Tap of A, the host takes 3 s to resume: longer than the replay window
+  tap_keys(HID_KEY_A, 1, 0, 30);
+  run_ms(100);
+  CHECK(mock_host_remote_wakeup_signalled());
+  CHECK_EQ(kb_wake_queue_count(&wake_queue), 2);
+  run_ms(3000);
+  CHECK_EQ(host_num_of_reports, 0);
+
+  uint32_t const resume_us = host_resume();
+  CHECK_EQ(host_num_of_reports, 2);
+  CHECK_EQ(host_keys[0], HID_KEY_A);
+  CHECK_EQ(host_keys[1], 0xFF);
+  // Press in the first frame after the resume, release in the next one
+  CHECK(host_reports_us[0] - resume_us <= 1000 + SCAN_PASS_MAX_US);
+  CHECK(host_reports_us[1] - host_reports_us[0] <= 1000 + SCAN_PASS_MAX_US);
+  CHECK_EQ(kb_wake_queue_count(&wake_queue), 0);
+}
+
+static void test_full_queue_keeps_order_and_latest_state(void){
+  host_suspend(true);
+
+  // A to L typed while the host sleeps: 24 changes for 8 entries
+  tap_keys(HID_KEY_A, 12, 40, 20);
+  run_ms(12 * 40 + 100);
+  CHECK_EQ(kb_wake_queue_count(&wake_queue), KB_WAKE_QUEUE_LEN);
+
+  host_resume();
+  // The first changes in order, then the latest state: nothing left pressed
+  CHECK_EQ(host_num_of_reports, KB_WAKE_QUEUE_LEN);
+  for(uint idx = 0; idx < KB_WAKE_QUEUE_LEN - 1; idx++){
+    CHECK_EQ(host_keys[idx], (idx & 1) ? 0xFF : HID_KEY_A + idx / 2);
+  }
+  CHECK_EQ(host_keys[KB_WAKE_QUEUE_LEN - 1], 0xFF);
+}
+
+static void test_keys_without_remote_wakeup_are_not_replayed(void){
+  host_suspend(false);
+
+  tap_keys(HID_KEY_B, 1, 0, 30);
+  run_ms(100);
+  CHECK(!mock_host_remote_wakeup_signalled());
+  CHECK_EQ(kb_wake_queue_count(&wake_queue), 0);
+
+  // Nothing held at the resume, the host already has that
+  host_resume();
+  CHECK_EQ(host_num_of_reports, 0);
+}
+
+//--------------------------------------------------------------------+
+// Tests: the replay window of the queue itself
+//--------------------------------------------------------------------+
+
+static kb_wake_queue_t queue;
+
+static kb_hid_payload_t payload_with_key(uint key){
+  kb_hid_payload_t payload;
+  memset(&payload, 0, sizeof(payload));
+  payload.nkro.keys[key / 8] |= (uint8_t) (1u << (key % 8));
+  payload.num_of_keycodes = 1;
+  return payload;
+}
+
+static void test_stalled_replay_is_dropped_after_window(void){
+  kb_wake_queue_clear(&queue);
+
+  kb_hid_payload_t const event = payload_with_key(HID_KEY_B);
+  kb_wake_queue_push(&queue, &event);
+  kb_wake_queue_push(&queue, &event);
+  kb_wake_queue_resume(&queue, 5000);
+
+  // The endpoint is never free during the window
+  kb_hid_payload_t peeked;
+  CHECK(kb_wake_queue_peek(&queue, 5000 + KB_WAKE_REPLAY_TIMEOUT_MS, &peeked));
+  CHECK(!kb_wake_queue_peek(&queue, 5000 + KB_WAKE_REPLAY_TIMEOUT_MS + 1, &peeked));
+  CHECK_EQ(kb_wake_queue_count(&queue), 0);
+}
+
+static void test_replay_without_resume_starts_at_first_replay(void){
+  kb_wake_queue_clear(&queue);
+
+  kb_hid_payload_t const event = payload_with_key(HID_KEY_C);
+  kb_wake_queue_push(&queue, &event);
+
+  // Bus reset instead of a resume: no tud_resume_cb()
+  kb_hid_payload_t peeked;
+  CHECK(kb_wake_queue_peek(&queue, 60000, &peeked));
+  kb_wake_queue_pop(&queue);
+
+  kb_wake_queue_push(&queue, &event);
+  CHECK(!kb_wake_queue_peek(&queue, 60000 + KB_WAKE_REPLAY_TIMEOUT_MS + 1, &peeked));
+}
+
+static void test_suspend_forgets_previous_events(void){
+  kb_wake_queue_clear(&queue);
+
+  kb_hid_payload_t const event = payload_with_key(HID_KEY_D);
+  kb_wake_queue_push(&queue, &event);
+  kb_wake_queue_resume(&queue, 0);
+
+  // Suspended again before the replay, with a new resume much later
+  kb_wake_queue_clear(&queue);
+  CHECK_EQ(kb_wake_queue_count(&queue), 0);
+  kb_wake_queue_push(&queue, &event);
+  kb_wake_queue_resume(&queue, 100000);
+
+  kb_hid_payload_t peeked;
+  CHECK(kb_wake_queue_peek(&queue, 100001, &peeked));
+  kb_wake_queue_pop(&queue);
+  CHECK(!kb_wake_queue_peek(&queue, 100002, &peeked));
+}
+
+int main(void){
+  fw_init();
+  fw_keys_cb = taps_keys;
+  mock_host_on_report(host_on_report);
+
+  RUN_TEST(test_enumerate);
+  RUN_TEST(test_key_that_woke_a_slow_host_is_replayed);
+  RUN_TEST(test_full_queue_keeps_order_and_latest_state);
+  RUN_TEST(test_keys_without_remote_wakeup_are_not_replayed);
+  RUN_TEST(test_stalled_replay_is_dropped_after_window);
+  RUN_TEST(test_replay_without_resume_starts_at_first_replay);
+  RUN_TEST(test_suspend_forgets_previous_events);
+  return test_result();
+}